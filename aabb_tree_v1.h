@@ -0,0 +1,369 @@
+/*
+PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+#include <physics/memory_v1.h>
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <utility>
+
+using std::vector;
+typedef glm::vec3 vec3;
+
+//Dynamic bounding volume tree (as in Box2D's b2DynamicTree).
+//Every item is a leaf (proxy) with a fat AABB: the bounds are enlarged by a margin so the
+//proxy is reinserted only when the item leaves them. Insertions and removals refit the
+//ancestors bottom up and rebalance them with rotations, so the tree stays shallow whatever
+//the size of the items and of the world.
+template <class T> class AABBTree
+{
+public:
+    struct node
+    {
+        vec3 min, max;
+        T* item = NULL;
+        int parent = -1;    //next free node when the node is not used
+        int left = -1, right = -1;
+        int height = -1;    //0 for leafs, -1 for free nodes
+
+        bool isLeaf() const { return left == -1; }
+    };
+
+    vTaggedVector<node, MEMORY_OCTREE> m_nodes;
+    int m_root = -1;
+    float m_margin;
+    float m_predict; //fat bounds are extended along the displacement by this factor
+
+private:
+    int m_free = -1;
+    int m_count = 0;
+
+public:
+    AABBTree(float margin = 0.1f, float predict = 2.0f)
+    {
+        m_margin = margin;
+        m_predict = predict;
+    }
+
+    int size()
+    {
+        return m_count;
+    }
+
+    void clear()
+    {
+        m_nodes.clear();
+        m_root = -1;
+        m_free = -1;
+        m_count = 0;
+    }
+
+    //returns the proxy id
+    int createProxy(T* item, const vec3 &min, const vec3 &max)
+    {
+        int id = allocateNode();
+        node &n = m_nodes[id];
+        n.min = min - vec3(m_margin, m_margin, m_margin);
+        n.max = max + vec3(m_margin, m_margin, m_margin);
+        n.item = item;
+        n.height = 0;
+        insertLeaf(id);
+        m_count++;
+        return id;
+    }
+
+    void destroyProxy(int id)
+    {
+        removeLeaf(id);
+        freeNode(id);
+        m_count--;
+    }
+
+    //returns true if the proxy has been reinserted
+    bool moveProxy(int id, const vec3 &min, const vec3 &max, const vec3 &displacement = vec3(.0f, .0f, .0f))
+    {
+        node &n = m_nodes[id];
+        if(n.min.x <= min.x && n.min.y <= min.y && n.min.z <= min.z &&
+           n.max.x >= max.x && n.max.y >= max.y && n.max.z >= max.z)
+            return false;
+
+        removeLeaf(id);
+
+        vec3 lo = min - vec3(m_margin, m_margin, m_margin);
+        vec3 hi = max + vec3(m_margin, m_margin, m_margin);
+        vec3 d = displacement * m_predict;
+        if(d.x < 0) lo.x += d.x; else hi.x += d.x;
+        if(d.y < 0) lo.y += d.y; else hi.y += d.y;
+        if(d.z < 0) lo.z += d.z; else hi.z += d.z;
+        m_nodes[id].min = lo;
+        m_nodes[id].max = hi;
+
+        insertLeaf(id);
+        return true;
+    }
+
+    T* getItem(int id)
+    {
+        return m_nodes[id].item;
+    }
+
+    //pairs of proxies with overlapping fat bounds, the tree is traversed against itself
+    void getPairs(vector<std::pair<T*, T*>> &result)
+    {
+        if(m_root == -1) return;
+
+        //(a, a) -> pairs inside the subtree a, (a, b) -> pairs between subtree a and subtree b
+        vector<std::pair<int, int>> stack;
+        stack.push_back(std::make_pair(m_root, m_root));
+        while(!stack.empty())
+        {
+            int a = stack.back().first, b = stack.back().second;
+            stack.pop_back();
+            const node &na = m_nodes[a];
+            const node &nb = m_nodes[b];
+
+            if(a == b)
+            {
+                if(na.isLeaf()) continue;
+                stack.push_back(std::make_pair(na.left, na.right));
+                stack.push_back(std::make_pair(na.right, na.right));
+                stack.push_back(std::make_pair(na.left, na.left));
+                continue;
+            }
+
+            if(!overlap(na, nb)) continue;
+
+            if(na.isLeaf() && nb.isLeaf())
+            {
+                result.push_back(std::make_pair(na.item, nb.item));
+                continue;
+            }
+
+            //descend the bigger node
+            if(nb.isLeaf() || (!na.isLeaf() && area(na.min, na.max) >= area(nb.min, nb.max)))
+            {
+                stack.push_back(std::make_pair(na.right, b));
+                stack.push_back(std::make_pair(na.left, b));
+            }
+            else
+            {
+                stack.push_back(std::make_pair(a, nb.right));
+                stack.push_back(std::make_pair(a, nb.left));
+            }
+        }
+    }
+
+    //items whose fat bounds overlap [min, max]
+    void query(const vec3 &min, const vec3 &max, vector<T*> &result)
+    {
+        if(m_root == -1) return;
+        vector<int> stack;
+        stack.push_back(m_root);
+        while(!stack.empty())
+        {
+            const node &n = m_nodes[stack.back()];
+            stack.pop_back();
+            if(n.min.x > max.x || n.max.x < min.x || n.min.y > max.y || n.max.y < min.y || n.min.z > max.z || n.max.z < min.z) continue;
+            if(n.isLeaf()) result.push_back(n.item);
+            else
+            {
+                stack.push_back(n.left);
+                stack.push_back(n.right);
+            }
+        }
+    }
+
+    int getHeight()
+    {
+        return m_root == -1 ? 0 : m_nodes[m_root].height;
+    }
+
+private:
+    static float area(const vec3 &min, const vec3 &max)
+    {
+        vec3 d = max - min;
+        return 2.0f * (d.x*d.y + d.y*d.z + d.z*d.x);
+    }
+
+    static bool overlap(const node &a, const node &b)
+    {
+        return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+               a.min.y <= b.max.y && a.max.y >= b.min.y &&
+               a.min.z <= b.max.z && a.max.z >= b.min.z;
+    }
+
+    int allocateNode()
+    {
+        if(m_free == -1)
+        {
+            m_nodes.push_back(node());
+            return m_nodes.size()-1;
+        }
+        int id = m_free;
+        m_free = m_nodes[id].parent;
+        m_nodes[id] = node();
+        return id;
+    }
+
+    void freeNode(int id)
+    {
+        m_nodes[id].parent = m_free;
+        m_nodes[id].height = -1;
+        m_nodes[id].item = NULL;
+        m_free = id;
+    }
+
+    //recompute bounds and height of a node from its children
+    void fit(int id)
+    {
+        node &n = m_nodes[id];
+        const node &l = m_nodes[n.left];
+        const node &r = m_nodes[n.right];
+        n.min = glm::min(l.min, r.min);
+        n.max = glm::max(l.max, r.max);
+        n.height = 1 + (l.height > r.height ? l.height : r.height);
+    }
+
+    void insertLeaf(int leaf)
+    {
+        if(m_root == -1)
+        {
+            m_root = leaf;
+            m_nodes[leaf].parent = -1;
+            return;
+        }
+
+        //find the best sibling (surface area heuristic)
+        vec3 lmin = m_nodes[leaf].min, lmax = m_nodes[leaf].max;
+        int index = m_root;
+        while(!m_nodes[index].isLeaf())
+        {
+            const node &n = m_nodes[index];
+            float a = area(n.min, n.max);
+            float combined = area(glm::min(n.min, lmin), glm::max(n.max, lmax));
+
+            float cost = 2.0f * combined;              //new parent for this node and the leaf
+            float inheritance = 2.0f * (combined - a); //minimum cost of pushing the leaf further down
+
+            float costLeft = descendCost(n.left, lmin, lmax) + inheritance;
+            float costRight = descendCost(n.right, lmin, lmax) + inheritance;
+
+            if(cost < costLeft && cost < costRight) break;
+            index = costLeft < costRight ? n.left : n.right;
+        }
+
+        //new parent
+        int sibling = index;
+        int oldParent = m_nodes[sibling].parent;
+        int newParent = allocateNode();
+        m_nodes[newParent].parent = oldParent;
+        m_nodes[newParent].left = sibling;
+        m_nodes[newParent].right = leaf;
+        m_nodes[sibling].parent = newParent;
+        m_nodes[leaf].parent = newParent;
+        fit(newParent);
+
+        if(oldParent == -1) m_root = newParent;
+        else if(m_nodes[oldParent].left == sibling) m_nodes[oldParent].left = newParent;
+        else m_nodes[oldParent].right = newParent;
+
+        refit(m_nodes[newParent].parent);
+    }
+
+    float descendCost(int id, const vec3 &lmin, const vec3 &lmax)
+    {
+        const node &c = m_nodes[id];
+        float a = area(glm::min(c.min, lmin), glm::max(c.max, lmax));
+        return c.isLeaf() ? a : a - area(c.min, c.max);
+    }
+
+    void removeLeaf(int leaf)
+    {
+        if(leaf == m_root)
+        {
+            m_root = -1;
+            return;
+        }
+
+        int parent = m_nodes[leaf].parent;
+        int grandParent = m_nodes[parent].parent;
+        int sibling = m_nodes[parent].left == leaf ? m_nodes[parent].right : m_nodes[parent].left;
+
+        if(grandParent == -1)
+        {
+            m_root = sibling;
+            m_nodes[sibling].parent = -1;
+        }
+        else
+        {
+            if(m_nodes[grandParent].left == parent) m_nodes[grandParent].left = sibling;
+            else m_nodes[grandParent].right = sibling;
+            m_nodes[sibling].parent = grandParent;
+        }
+        freeNode(parent);
+        refit(grandParent);
+    }
+
+    //walk up from 'index' rebalancing and refitting every ancestor
+    void refit(int index)
+    {
+        while(index != -1)
+        {
+            index = balance(index);
+            fit(index);
+            index = m_nodes[index].parent;
+        }
+    }
+
+    //rotate the node if its subtrees heights differ by more than one, returns the new subtree root
+    int balance(int a)
+    {
+        node &A = m_nodes[a];
+        if(A.isLeaf() || A.height < 2) return a;
+
+        int b = A.left, c = A.right;
+        int d = m_nodes[c].height - m_nodes[b].height;
+
+        if(d > 1) return rotate(a, c, true);
+        if(d < -1) return rotate(a, b, false);
+        return a;
+    }
+
+    //promote 'up' (child of a) in place of a
+    int rotate(int a, int up, bool upIsRight)
+    {
+        node &U = m_nodes[up];
+        int f = U.left, g = U.right;
+
+        //swap a and up
+        U.left = a;
+        U.parent = m_nodes[a].parent;
+        m_nodes[a].parent = up;
+
+        if(U.parent != -1)
+        {
+            if(m_nodes[U.parent].left == a) m_nodes[U.parent].left = up;
+            else m_nodes[U.parent].right = up;
+        }
+        else m_root = up;
+
+        //the higher child of up stays with up, the other goes to a
+        int keep = m_nodes[f].height > m_nodes[g].height ? f : g;
+        int give = keep == f ? g : f;
+
+        U.right = keep;
+        if(upIsRight) m_nodes[a].right = give; else m_nodes[a].left = give;
+        m_nodes[give].parent = a;
+
+        fit(a);
+        fit(up);
+        return up;
+    }
+};
@@ -0,0 +1,762 @@
+/*
+PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+//Physics class
+#include <physics/verlet/verlet_physics_v1.h>
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+//Microbenchmarks of the inner kernels (narrow phase, response, constraints, integration, octree).
+//Every kernel runs on random inputs made from a fixed seed, so two runs see the same data.
+//A bench can take a candidate implementation of the kernel: it is timed on the same inputs
+//and its results are checked against the current (scalar) one, the mismatches are reported.
+//
+//  vBench bench;
+//  bench.runAll();
+//  bench.sphereSphere([](vRigidBody::sphere a, vRigidBody::sphere b, vec3 i) { return mySphereTest(a, b); });
+
+//xorshift32, the same sequence on every platform
+class vBenchRandom
+{
+    uint32_t m_state;
+
+public:
+    vBenchRandom(uint32_t seed = 1) { this->m_state = seed ? seed : 1; }
+
+    uint32_t next()
+    {
+        uint32_t x = this->m_state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return this->m_state = x;
+    }
+
+    //[lo, hi)
+    float range(float lo, float hi)
+    {
+        return lo + (hi-lo) * (this->next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    vec3 point(float lo, float hi)
+    {
+        float x = this->range(lo, hi);
+        float y = this->range(lo, hi);
+        float z = this->range(lo, hi);
+        return vec3(x, y, z);
+    }
+
+    vec3 direction()
+    {
+        while(true)
+        {
+            vec3 d = this->point(-1.0f, 1.0f);
+            float l = glm::dot(d, d);
+            if(l > .0001f && l <= 1.0f) return d / std::sqrt(l);
+        }
+    }
+};
+
+//hardware counters of the calling thread through perf_event_open. the counters that can't be
+//opened (other OS, no permission, virtual machine) read -1, the timings don't need them
+class vPerfCounters
+{
+public:
+    enum Counter { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, COUNT };
+
+private:
+    int m_fds[COUNT];
+
+public:
+    vPerfCounters()
+    {
+        for(int i = 0; i < COUNT; i++) this->m_fds[i] = -1;
+#ifdef __linux__
+        const uint64_t configs[COUNT] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+        for(int i = 0; i < COUNT; i++)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            this->m_fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+#endif
+    }
+
+    ~vPerfCounters()
+    {
+#ifdef __linux__
+        for(int i = 0; i < COUNT; i++) if(this->m_fds[i] >= 0) close(this->m_fds[i]);
+#endif
+    }
+
+    vPerfCounters(const vPerfCounters&) = delete;
+
+    vPerfCounters& operator=(const vPerfCounters&) = delete;
+
+    bool isAvailable(Counter c) { return this->m_fds[c] >= 0; }
+
+    bool isAvailable()
+    {
+        for(int i = 0; i < COUNT; i++) if(this->m_fds[i] >= 0) return true;
+        return false;
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        for(int i = 0; i < COUNT; i++) if(this->m_fds[i] >= 0)
+        {
+            ioctl(this->m_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(this->m_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    //values counted since start, -1 for the missing counters
+    void stop(long long values[COUNT])
+    {
+        for(int i = 0; i < COUNT; i++) values[i] = -1;
+#ifdef __linux__
+        for(int i = 0; i < COUNT; i++) if(this->m_fds[i] >= 0)
+        {
+            ioctl(this->m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t v;
+            if(read(this->m_fds[i], &v, sizeof(v)) == sizeof(v)) values[i] = v;
+        }
+#endif
+    }
+};
+
+struct vBenchResult
+{
+    std::string name;
+    long long ops = 0;       //kernel calls per repetition
+    double nsPerOp = 0;      //best repetition
+    double opsPerSecond = 0;
+    double counters[vPerfCounters::COUNT] = { -1, -1, -1, -1 }; //per op, -1 if not available
+
+    //only for the candidates
+    bool checked = false;
+    long long mismatches = 0;
+};
+
+class vBench
+{
+public:
+    typedef vRigidBody::box box;
+    typedef vRigidBody::sphere sphere;
+    typedef vRigidBody::triangle triangle;
+
+    //candidate signatures, the same as the kernels they replace
+    typedef std::function<bool(box, box, vec3&)> boxBoxFn;
+    typedef std::function<bool(sphere, sphere, vec3)> sphereSphereFn;
+    typedef std::function<bool(sphere, box, vec3)> sphereBoxFn;
+    typedef std::function<bool(sphere, box)> sphereAxisAlignedFn;
+    typedef std::function<bool(vec3, vec3, triangle, vec3&)> rayTriangleFn;
+    typedef std::function<void(vec3&, vec3&, vec3, vec3, float, vec3, float, vec3, vec3, float)> reflectFn;
+    typedef std::function<void(vec3&, vec3&, float, float, float)> projectFn;             //vConnection::project
+    typedef std::function<void(vector<vParticle>&, float)> integrateFn;                  //vParticle::update on every particle
+    typedef std::function<void(vector<vRigidBody*>&, vector<std::pair<int,int>>&)> pairsFn; //pairs of body ids sharing an octree leaf
+
+    //options
+    uint32_t seed = 1;
+    int inputs = 1 << 14;     //random inputs per bench
+    int passes = 16;          //passes over the inputs per repetition
+    int warmup = 1;           //untimed repetitions
+    int repetitions = 5;      //the best one is reported
+    float tolerance = 1e-4f;  //on the vectors of the cross-checks (relative to their size)
+    int octreeBodies = 2048;
+    int octreeDepth = 4;
+    int reorderBodies = 16384;
+    bool counters = true;
+    bool print = true;
+
+private:
+    vPerfCounters * m_perf = NULL;
+    volatile long long m_sink = 0; //keeps the results alive
+
+public:
+    vBench() {}
+
+    ~vBench()
+    {
+        delete this->m_perf;
+    }
+
+    vBench(const vBench&) = delete;
+
+    vBench& operator=(const vBench&) = delete;
+
+    //the reference kernels, their results are in 'results'
+    void runAll(vector<vBenchResult> * results = NULL)
+    {
+        vector<vBenchResult> all;
+        all.push_back(this->boxBox());
+        all.push_back(this->sphereSphere());
+        all.push_back(this->sphereBox());
+        all.push_back(this->sphereAxisAligned());
+        all.push_back(this->rayTriangle());
+        all.push_back(this->reflect());
+        all.push_back(this->constraint());
+        all.push_back(this->integrate());
+        all.push_back(this->octree());
+        vBenchResult churned;
+        vBenchResult packed = this->reorder(&churned);
+        all.push_back(churned);
+        all.push_back(packed);
+        if(results) results->insert(results->end(), all.begin(), all.end());
+    }
+
+    //box::collide on oriented boxes, about half of the pairs overlap
+    vBenchResult boxBox(boxBoxFn candidate = NULL)
+    {
+        vBenchRandom r(this->seed);
+        vector<box> a(this->inputs), b(this->inputs);
+        for(int i = 0; i < this->inputs; i++)
+        {
+            a[i] = randomBox(r, 2.0f);
+            b[i] = randomBox(r, 2.0f);
+        }
+
+        vBenchResult res = measure("box::collide", [&]()
+        {
+            long long hits = 0;
+            vec3 p;
+            for(int i = 0; i < this->inputs; i++) hits += box::collide(a[i], b[i], p);
+            return hits;
+        });
+        if(!candidate) return report(res);
+
+        vBenchResult c = measure("box::collide [candidate]", [&]()
+        {
+            long long hits = 0;
+            vec3 p;
+            for(int i = 0; i < this->inputs; i++) hits += candidate(a[i], b[i], p);
+            return hits;
+        });
+        c.checked = true;
+        for(int i = 0; i < this->inputs; i++)
+        {
+            vec3 p(.0f), q(.0f);
+            bool x = box::collide(a[i], b[i], p);
+            bool y = candidate(a[i], b[i], q);
+            if(x != y || (x && !close(p, q))) c.mismatches++;
+        }
+        report(res);
+        return report(c);
+    }
+
+    vBenchResult sphereSphere(sphereSphereFn candidate = NULL)
+    {
+        vBenchRandom r(this->seed);
+        vector<sphere> a(this->inputs), b(this->inputs);
+        for(int i = 0; i < this->inputs; i++)
+        {
+            a[i] = randomSphere(r, 2.0f);
+            b[i] = randomSphere(r, 2.0f);
+        }
+
+        vBenchResult res = measure("sphere::collide(sphere)", [&]()
+        {
+            long long hits = 0;
+            for(int i = 0; i < this->inputs; i++) hits += sphere::collide(a[i], b[i], vec3(.0f));
+            return hits;
+        });
+        if(!candidate) return report(res);
+
+        vBenchResult c = measure("sphere::collide(sphere) [candidate]", [&]()
+        {
+            long long hits = 0;
+            for(int i = 0; i < this->inputs; i++) hits += candidate(a[i], b[i], vec3(.0f));
+            return hits;
+        });
+        c.checked = true;
+        for(int i = 0; i < this->inputs; i++)
+            if(sphere::collide(a[i], b[i], vec3(.0f)) != candidate(a[i], b[i], vec3(.0f))) c.mismatches++;
+        report(res);
+        return report(c);
+    }
+
+    vBenchResult sphereBox(sphereBoxFn candidate = NULL)
+    {
+        vBenchRandom r(this->seed);
+        vector<sphere> a(this->inputs);
+        vector<box> b(this->inputs);
+        for(int i = 0; i < this->inputs; i++)
+        {
+            a[i] = randomSphere(r, 2.0f);
+            b[i] = randomBox(r, 2.0f);
+        }
+
+        vBenchResult res = measure("sphere::collide(box)", [&]()
+        {
+            long long hits = 0;
+            for(int i = 0; i < this->inputs; i++) hits += sphere::collide(a[i], b[i], vec3(.0f));
+            return hits;
+        });
+        if(!candidate) return report(res);
+
+        vBenchResult c = measure("sphere::collide(box) [candidate]", [&]()
+        {
+            long long hits = 0;
+            for(int i = 0; i < this->inputs; i++) hits += candidate(a[i], b[i], vec3(.0f));
+            return hits;
+        });
+        c.checked = true;
+        for(int i = 0; i < this->inputs; i++)
+            if(sphere::collide(a[i], b[i], vec3(.0f)) != candidate(a[i], b[i], vec3(.0f))) c.mismatches++;
+        report(res);
+        return report(c);
+    }
+
+    vBenchResult sphereAxisAligned(sphereAxisAlignedFn candidate = NULL)
+    {
+        vBenchRandom r(this->seed);
+        vector<sphere> a(this->inputs);
+        vector<box> b(this->inputs);
+        for(int i = 0; i < this->inputs; i++)
+        {
+            a[i] = randomSphere(r, 2.0f);
+            b[i] = box::createFromAxisAligned(r.point(-2.0f, 2.0f), r.range(.2f, 2.0f));
+        }
+
+        vBenchResult res = measure("sphere::collideAxisAligned", [&]()
+        {
+            long long hits = 0;
+            for(int i = 0; i < this->inputs; i++) hits += sphere::collideAxisAligned(a[i], b[i]);
+            return hits;
+        });
+        if(!candidate) return report(res);
+
+        vBenchResult c = measure("sphere::collideAxisAligned [candidate]", [&]()
+        {
+            long long hits = 0;
+            for(int i = 0; i < this->inputs; i++) hits += candidate(a[i], b[i]);
+            return hits;
+        });
+        c.checked = true;
+        for(int i = 0; i < this->inputs; i++)
+            if(sphere::collideAxisAligned(a[i], b[i]) != candidate(a[i], b[i])) c.mismatches++;
+        report(res);
+        return report(c);
+    }
+
+    //rays from around the origin toward triangles around it, some miss or are parallel
+    vBenchResult rayTriangle(rayTriangleFn candidate = NULL)
+    {
+        vBenchRandom r(this->seed);
+        vector<vec3> origin(this->inputs), dir(this->inputs);
+        vector<triangle> tri(this->inputs);
+        for(int i = 0; i < this->inputs; i++)
+        {
+            origin[i] = r.point(-.5f, .5f);
+            dir[i] = r.direction();
+            vec3 c = r.direction() * r.range(1.0f, 3.0f);
+            tri[i] = triangle::create(c + r.point(-1.0f, 1.0f), c + r.point(-1.0f, 1.0f), c + r.point(-1.0f, 1.0f), 0, 1, 2);
+        }
+
+        vBenchResult res = measure("triangle::rayIntersect", [&]()
+        {
+            long long hits = 0;
+            vec3 p;
+            for(int i = 0; i < this->inputs; i++) hits += triangle::rayIntersect(origin[i], dir[i], tri[i], p);
+            return hits;
+        });
+        if(!candidate) return report(res);
+
+        vBenchResult c = measure("triangle::rayIntersect [candidate]", [&]()
+        {
+            long long hits = 0;
+            vec3 p;
+            for(int i = 0; i < this->inputs; i++) hits += candidate(origin[i], dir[i], tri[i], p);
+            return hits;
+        });
+        c.checked = true;
+        for(int i = 0; i < this->inputs; i++)
+        {
+            vec3 p(.0f), q(.0f);
+            bool x = triangle::rayIntersect(origin[i], dir[i], tri[i], p);
+            bool y = candidate(origin[i], dir[i], tri[i], q);
+            if(x != y || (x && !close(p, q))) c.mismatches++;
+        }
+        report(res);
+        return report(c);
+    }
+
+    //particles hitting a plane through the intersection point, against a finite or an infinite mass
+    vBenchResult reflect(reflectFn candidate = NULL)
+    {
+        struct input { vec3 pos, last, velB, point, normal; float massA, massB, radius; };
+        vBenchRandom r(this->seed);
+        vector<input> in(this->inputs);
+        for(int i = 0; i < this->inputs; i++)
+        {
+            input &e = in[i];
+            e.normal = r.direction();
+            e.point = r.point(-1.0f, 1.0f);
+            e.radius = r.range(.0f, .5f);
+            e.pos = e.point - e.normal * r.range(.01f, .5f) + r.point(-.1f, .1f);
+            e.last = e.pos + e.normal * r.range(.01f, .2f) + r.point(-.05f, .05f);
+            e.velB = r.point(-.1f, .1f);
+            e.massA = r.range(.1f, 10.0f);
+            e.massB = (r.next() & 3) == 0 ? INFINITY : r.range(.1f, 10.0f);
+        }
+
+        vector<vec3> outPos(this->inputs), outLast(this->inputs);
+        vBenchResult res = measure("Collision::reflectpatricle", [&]()
+        {
+            for(int i = 0; i < this->inputs; i++)
+            {
+                const input &e = in[i];
+                Collision::reflectpatricle(outPos[i], outLast[i], e.pos, e.last, e.massA, e.velB, e.massB, e.point, e.normal, e.radius);
+            }
+            return (long long)outPos[this->inputs/2].x;
+        });
+        if(!candidate) return report(res);
+
+        vector<vec3> candPos(this->inputs), candLast(this->inputs);
+        vBenchResult c = measure("Collision::reflectpatricle [candidate]", [&]()
+        {
+            for(int i = 0; i < this->inputs; i++)
+            {
+                const input &e = in[i];
+                candidate(candPos[i], candLast[i], e.pos, e.last, e.massA, e.velB, e.massB, e.point, e.normal, e.radius);
+            }
+            return (long long)candPos[this->inputs/2].x;
+        });
+        c.checked = true;
+        for(int i = 0; i < this->inputs; i++)
+            if(!close(outPos[i], candPos[i]) || !close(outLast[i], candLast[i])) c.mismatches++;
+        report(res);
+        return report(c);
+    }
+
+    //vConnection::enforceConstraint on stretched and compressed connections.
+    //the candidate replaces the kernel it calls, vConnection::project
+    vBenchResult constraint(projectFn candidate = NULL)
+    {
+        vBenchRandom r(this->seed);
+        vector<vParticle> particles;
+        particles.reserve(2*this->inputs);
+        for(int i = 0; i < this->inputs; i++)
+        {
+            vec3 a = r.point(-5.0f, 5.0f);
+            vec3 b = a + r.direction() * r.range(.5f, 2.0f);
+            particles.push_back(vParticle(0, 2*i, a, r.range(.1f, 10.0f), .0f, 100.0f));
+            particles.push_back(vParticle(0, 2*i+1, b, r.range(.1f, 10.0f), .0f, 100.0f));
+        }
+        vector<vConnection> connections;
+        connections.reserve(this->inputs);
+        for(int i = 0; i < this->inputs; i++) connections.push_back(vConnection(&particles[2*i], &particles[2*i+1]));
+
+        //move the ends away from the rest length, every repetition starts from here
+        vector<vec3> start(2*this->inputs);
+        for(int i = 0; i < 2*this->inputs; i++) start[i] = particles[i].getPosition() + r.point(-.3f, .3f);
+
+        vBenchResult res = measure("vConnection::enforceConstraint", [&]()
+        {
+            for(int i = 0; i < 2*this->inputs; i++) particles[i].setPosition(start[i]);
+            for(int p = 0; p < this->passes; p++)
+                for(int i = 0; i < this->inputs; i++) connections[i].enforceConstraint();
+            return (long long)particles[this->inputs].getPosition().x;
+        }, this->passes);
+        if(!candidate) return report(res);
+
+        vector<vec3> pos(2*this->inputs);
+        vector<float> ka(this->inputs), kb(this->inputs), length(this->inputs);
+        for(int i = 0; i < this->inputs; i++)
+        {
+            float ma = particles[2*i].getMass(), mb = particles[2*i+1].getMass();
+            ka[i] = mb/(ma+mb);
+            kb[i] = ma/(ma+mb);
+            length[i] = glm::distance(particles[2*i].getPosition(), particles[2*i+1].getPosition());
+        }
+        vBenchResult c = measure("vConnection::enforceConstraint [candidate]", [&]()
+        {
+            std::copy(start.begin(), start.end(), pos.begin());
+            for(int p = 0; p < this->passes; p++)
+                for(int i = 0; i < this->inputs; i++) candidate(pos[2*i], pos[2*i+1], ka[i], kb[i], length[i]);
+            return (long long)pos[this->inputs].x;
+        }, this->passes);
+        c.checked = true;
+        for(int i = 0; i < 2*this->inputs; i++) particles[i].setPosition(start[i]);
+        std::copy(start.begin(), start.end(), pos.begin());
+        for(int i = 0; i < this->inputs; i++)
+        {
+            connections[i].enforceConstraint();
+            candidate(pos[2*i], pos[2*i+1], ka[i], kb[i], length[i]);
+            if(!close(particles[2*i].getPosition(), pos[2*i]) || !close(particles[2*i+1].getPosition(), pos[2*i+1])) c.mismatches++;
+        }
+        report(res);
+        return report(c);
+    }
+
+    //vParticle::update with gravity, drag, forces and the world bounds
+    vBenchResult integrate(integrateFn candidate = NULL)
+    {
+        const float dt = 1.0f/60.0f;
+        vBenchRandom r(this->seed);
+        vector<vParticle> start;
+        start.reserve(this->inputs);
+        for(int i = 0; i < this->inputs; i++)
+        {
+            vParticle p(0, i, r.point(-9.0f, 9.0f), r.range(.1f, 10.0f), r.range(.0f, 2.0f), 10.0f, (r.next() & 7) != 0);
+            p.setPosition(p.getPosition(), p.getPosition() - r.point(-.2f, .2f));
+            if(r.next() & 1) p.applyForce(r.point(-50.0f, 50.0f));
+            start.push_back(p);
+        }
+
+        vector<vParticle> particles = start;
+        vBenchResult res = measure("vParticle::update", [&]()
+        {
+            particles = start;
+            for(int p = 0; p < this->passes; p++)
+                for(int i = 0; i < this->inputs; i++) particles[i].update(dt);
+            return (long long)particles[this->inputs/2].getPosition().x;
+        }, this->passes);
+        if(!candidate) return report(res);
+
+        vector<vParticle> other = start;
+        vBenchResult c = measure("vParticle::update [candidate]", [&]()
+        {
+            other = start;
+            for(int p = 0; p < this->passes; p++) candidate(other, dt);
+            return (long long)other[this->inputs/2].getPosition().x;
+        }, this->passes);
+        c.checked = true;
+        particles = start;
+        other = start;
+        for(int i = 0; i < this->inputs; i++) particles[i].update(dt);
+        candidate(other, dt);
+        for(int i = 0; i < this->inputs; i++)
+            if(!close(particles[i].getPosition(), other[i].getPosition()) || !close(particles[i].getLastPosition(), other[i].getLastPosition())) c.mismatches++;
+        report(res);
+        return report(c);
+    }
+
+    //Octree::updateTree on spheres of mixed sizes, one op is one body inserted.
+    //the candidate fills the pairs of bodies (a < b) that share a leaf
+    vBenchResult octree(pairsFn candidate = NULL)
+    {
+        const float worldSize = 50.0f;
+        vBenchRandom r(this->seed);
+        GLfloat color[3] = { 1.0f, 1.0f, 1.0f };
+        vector<vRigidBody*> bodies;
+        for(int i = 0; i < this->octreeBodies; i++)
+            bodies.push_back(new Sphere(i, r.point(-worldSize*.9f, worldSize*.9f), color, vec3(.0f), r.range(.2f, 3.0f), 1.0f, .0f, .5f, false, false, worldSize));
+
+        vec3 center(.0f);
+        int depth = this->octreeDepth;
+        Octree<vRigidBody> tree(center, worldSize*2.0f, depth);
+
+        vBenchResult res = measure("Octree::updateTree", [&]()
+        {
+            tree.updateTree(bodies);
+            return (long long)tree.root->m_subNodes.size();
+        }, 1, this->octreeBodies);
+
+        if(candidate)
+        {
+            vector<std::pair<int,int>> pairs;
+            vBenchResult c = measure("Octree::updateTree [candidate]", [&]()
+            {
+                pairs.clear();
+                candidate(bodies, pairs);
+                return (long long)pairs.size();
+            }, 1, this->octreeBodies);
+            c.checked = true;
+
+            vector<std::pair<int,int>> reference;
+            tree.updateTree(bodies);
+            leafPairs(tree, reference);
+            pairs.clear();
+            candidate(bodies, pairs);
+            for(int i = 0; i < pairs.size(); i++) if(pairs[i].first > pairs[i].second) std::swap(pairs[i].first, pairs[i].second);
+            std::sort(pairs.begin(), pairs.end());
+            pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+            //pairs only one side found
+            vector<std::pair<int,int>> diff;
+            std::set_symmetric_difference(reference.begin(), reference.end(), pairs.begin(), pairs.end(), std::back_inserter(diff));
+            c.mismatches = diff.size();
+            report(res);
+            res = c;
+        }
+
+        tree.root->clear();
+        for(int i = 0; i < bodies.size(); i++) delete bodies[i];
+        return report(res);
+    }
+
+    //vRigidBody::update + updateConstraint over the boxes of a world in the order of m_rBodies, first
+    //after some churn (bodies removed and added in random places, their particles end up scattered
+    //in the heap) and then after vPhysics::reorderBodies packed them in Morton order. compare the
+    //cache misses of the two results: the packed world is returned, the churned one in 'churned'
+    vBenchResult reorder(vBenchResult * churned = NULL)
+    {
+        const float worldSize = 100.0f, dt = 1.0f/60.0f;
+        vBenchRandom r(this->seed);
+        GLfloat color[3] = { 1.0f, 1.0f, 1.0f };
+        vPhysics world;
+        world.setWorld(worldSize);
+
+        vector<vPhysics::bodyHandle> handles;
+        std::function<void()> add = [&]()
+        {
+            vPhysics::boxPrefab b;
+            b.color = color;
+            b.pos = r.point(-worldSize*.9f, worldSize*.9f);
+            b.gravity = false;
+            handles.push_back(world.getHandle(world.addBox(b)));
+        };
+        for(int i = 0; i < this->reorderBodies; i++) add();
+        for(int i = 0; i < this->reorderBodies; i++)
+        {
+            int k = r.next() % handles.size();
+            world.removeBody(handles[k]);
+            handles[k] = handles.back();
+            handles.pop_back();
+            add();
+        }
+
+        std::function<long long()> pass = [&]()
+        {
+            vector<vRigidBody*> &bodies = *world.getRigidBodies();
+            for(int i = 0; i < bodies.size(); i++)
+            {
+                bodies[i]->update(dt);
+                bodies[i]->updateConstraint();
+            }
+            return (long long)bodies[bodies.size()/2]->getPosition().x;
+        };
+
+        vBenchResult before = measure("vRigidBody::update (churned)", pass, 1, this->reorderBodies);
+        world.reorderBodies();
+        vBenchResult after = measure("vRigidBody::update (reorderBodies)", pass, 1, this->reorderBodies);
+        report(before);
+        if(churned) *churned = before;
+        return report(after);
+    }
+
+    //sorted pairs of body ids (a < b) sharing a leaf of the tree
+    static void leafPairs(Octree<vRigidBody> &tree, vector<std::pair<int,int>> &pairs)
+    {
+        vector<Octree<vRigidBody>::OctreeNode*> leafs;
+        tree.getLeafsWithObj(&leafs);
+        for(int l = 0; l < leafs.size(); l++)
+        {
+            vector<vRigidBody*> &items = leafs[l]->m_items;
+            for(int i = 0; i < items.size(); i++)
+                for(int j = i+1; j < items.size(); j++)
+                    pairs.push_back(std::make_pair(std::min(items[i]->getId(), items[j]->getId()), std::max(items[i]->getId(), items[j]->getId())));
+        }
+        std::sort(pairs.begin(), pairs.end());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+    }
+
+    static void printResult(const vBenchResult &res)
+    {
+        std::cout << std::left << std::setw(44) << res.name << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(10) << res.nsPerOp << " ns/op "
+                  << std::setprecision(1) << std::setw(12) << res.opsPerSecond / 1e6 << " Mops/s";
+        const char * names[vPerfCounters::COUNT] = { "cycles", "instr", "cache-miss", "branch-miss" };
+        for(int i = 0; i < vPerfCounters::COUNT; i++)
+            if(res.counters[i] >= 0) std::cout << " " << std::setprecision(2) << res.counters[i] << " " << names[i];
+        if(res.checked && res.mismatches == 0) std::cout << "  [check ok]";
+        if(res.checked && res.mismatches > 0) std::cout << "  [check FAILED: " << res.mismatches << " mismatches]";
+        std::cout << std::endl;
+    }
+
+private:
+    box randomBox(vBenchRandom &r, float spread)
+    {
+        //random orthonormal axes
+        vec3 x = r.direction();
+        vec3 y = glm::cross(x, r.direction());
+        while(glm::dot(y, y) < .0001f) y = glm::cross(x, r.direction());
+        y = glm::normalize(y);
+        vec3 z = glm::cross(x, y);
+        return box::create(r.point(-spread, spread), x, y, z, r.range(.2f, 1.5f), r.range(.2f, 1.5f), r.range(.2f, 1.5f));
+    }
+
+    sphere randomSphere(vBenchRandom &r, float spread)
+    {
+        return sphere::create(r.point(-spread, spread), r.range(.1f, 1.5f));
+    }
+
+    bool close(vec3 a, vec3 b)
+    {
+        if(!(std::isfinite(a.x) && std::isfinite(a.y) && std::isfinite(a.z)))
+            return std::memcmp(&a, &b, sizeof(vec3)) == 0; //nan and inf must match too
+        float scale = std::max(1.0f, std::max(std::abs(a.x), std::max(std::abs(a.y), std::abs(a.z))));
+        return std::abs(a.x-b.x) <= this->tolerance*scale && std::abs(a.y-b.y) <= this->tolerance*scale && std::abs(a.z-b.z) <= this->tolerance*scale;
+    }
+
+    //'run' does one repetition: 'passes' passes over the inputs, or 'opsPerPass' ops for the octree
+    template <typename F>
+    vBenchResult measure(const std::string &name, F run, int passes = 1, int opsPerPass = -1)
+    {
+        vBenchResult res;
+        res.name = name;
+        res.ops = (long long)passes * (opsPerPass < 0 ? this->inputs : opsPerPass);
+
+        if(this->counters && this->m_perf == NULL) this->m_perf = new vPerfCounters();
+        for(int i = 0; i < this->warmup; i++) this->m_sink += run();
+
+        double best = -1;
+        for(int i = 0; i < this->repetitions; i++)
+        {
+            long long values[vPerfCounters::COUNT];
+            if(this->counters) this->m_perf->start();
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            this->m_sink += run();
+            std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+            if(this->counters) this->m_perf->stop(values);
+
+            double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+            if(best >= 0 && ns >= best) continue;
+            best = ns;
+            for(int k = 0; k < vPerfCounters::COUNT; k++)
+                res.counters[k] = this->counters && values[k] >= 0 ? (double)values[k] / res.ops : -1;
+        }
+
+        res.nsPerOp = best / res.ops;
+        res.opsPerSecond = best > 0 ? res.ops * 1e9 / best : 0;
+        return res;
+    }
+
+    vBenchResult report(const vBenchResult &res)
+    {
+        if(this->print) printResult(res);
+        return res;
+    }
+};
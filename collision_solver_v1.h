@@ -11,12 +11,124 @@ Real-Time Graphics Programming's Project - 2019/2020
 #include <physics/verlet/verlet_physics_v1.h>
 #include <physics/octree_v1.h>
 #include <physics/collision_v1.h>
+#include <physics/lbvh_v1.h>
+#include <physics/aabb_tree_v1.h>
+
+#include <unordered_map>
+#include <algorithm>
 
 //CHECK FREEMEM CLEAN AND ALL METHOD TO FREE UP MEMORY
 class CollisionSolver
 {
+    //a pair of bodies that touched in a previous step.
+    //corrections are the displacement the responses gave to each particle,
+    //they are reused as they are while the pair is resting (warm start)
+    struct contact
+    {
+        struct correction
+        {
+            vector<int> id;
+            Movable * mov;
+            vec3 dPos, dOld;
+        };
+
+        int step = -1;              //last step the pair was touching
+        vRigidBody *a = NULL, *b = NULL;
+        unsigned epochA = 0, epochB = 0;
+        vec3 refA, refB;            //position of a, b when the contact was evaluated
+        vec3 axisA, axisB;          //x axis of a, b when the contact was evaluated
+        vec3 normal, point;
+        vector<correction> corrections;
+        int reused = 0;             //consecutive steps the contact has been reused
+        float impulse = 0;
+    };
+
+    typedef std::pair<const unsigned long long, contact> contactEntry;
+    std::unordered_map<unsigned long long, contact, std::hash<unsigned long long>, std::equal_to<unsigned long long>, vTaggedAllocator<contactEntry, MEMORY_CONTACTS>> m_contacts;
+    vector<unsigned> m_epoch; //body id -> number of times the id has been recycled
+    int m_step = 0;
+
+    //pairs touching in a step sorted by key, the events come from merging two consecutive steps
+    struct touching
+    {
+        unsigned long long key;
+        int a, b;
+        unsigned epochA, epochB;
+        vec3 normal, point;
+        float impulse;
+    };
+    vector<touching> m_touching, m_lastTouching;
+
+    //trigger overlaps of a step, sorted by key like the contacts
+    struct overlap
+    {
+        unsigned long long key;
+        int trigger, other;
+        unsigned epochTrigger, epochOther;
+    };
+    vector<overlap> m_overlaps, m_lastOverlaps;
+
+    //what a step leaves to the next one, saved for every frame the rollback can restore.
+    //the particles of the corrections are kept as (a or b, index): they may move (packBodies)
+    struct history
+    {
+        int frame = -1;
+        int step;
+        vector<std::pair<unsigned long long, contact>> contacts;
+        vector<std::pair<int, int>> particles;
+        vector<touching> pairs;
+        vector<overlap> overlaps;
+    };
+    vector<history, vTaggedAllocator<history, MEMORY_CONTACTS>> m_history;
+
     public:
+    //structure used to find the pairs of bodies that may collide
+    enum BroadPhase
+    {
+        OCTREE,         //bodies are inserted in every leaf they touch, pairs are deduplicated
+        LOOSE_OCTREE,   //each body is stored once in a loose octree
+        LBVH_TREE,      //linear BVH built in parallel from the Morton codes of the bodies
+        AABB_TREE       //dynamic AABB tree, proxies are reinserted only when they leave their fat bounds
+    };
+    BroadPhase broadPhase = OCTREE;
+
+    //change in the contacts between two steps
+    struct contactEvent
+    {
+        enum Type { BEGIN, PERSIST, END } type;
+        int a, b;           //body ids, a < b. after an END they may belong to removed bodies
+        vec3 normal, point; //normal from b to a. an END carries the last ones
+        float impulse;      //momentum given to the most pushed body of the pair, 0 for END
+    };
+    bool contactEvents = true;
+    vector<contactEvent> m_events;
+
+    //a body entering or leaving a trigger
+    struct triggerEvent
+    {
+        enum Type { ENTER, EXIT } type;
+        int trigger, other; //body ids. after an EXIT they may belong to removed bodies
+    };
+    vector<triggerEvent> m_triggerEvents;
+
+    //the responses on ghost bodies (vRigidBody::setGhost) are not applied: they are kept for the
+    //process that simulates the body, as offsets of its particles. refilled by every step
+    struct ghostResponse
+    {
+        int body, particle; //body id, index of the particle in the body
+        vec3 dPos, dOld;    //offset of the position and of the last position
+    };
+    vector<ghostResponse> m_ghostResponses;
+
     vector<vRigidBody*>* m_rBodies;
+    vector<vRigidBody*> m_dynamic;  //dynamic + kinematic bodies, the ones in the broad phase
+    vector<vRigidBody*> m_static;
+    vector<char> m_ghost; //body id -> ghost
+
+    //static bodies never move: they live in their own tree, rebuilt only when they change
+    AABBTree<vRigidBody> m_staticTree = AABBTree<vRigidBody>(0.0f);
+    bool m_staticDirty = true;
+    vector<vRigidBody*> m_staticHits;
     vector<Collision*> colls;
     vector<Response*> resp;
     vector<vector<int>> collisionId;
@@ -26,16 +138,38 @@ class CollisionSolver
     int octreeDepth = 5;
     vector<class Octree<vRigidBody>::OctreeNode*> octreeLeafs;
     Octree<vRigidBody> * m_tree;
+    LooseOctree<vRigidBody> * m_looseTree;
+    LBVH<vRigidBody> m_lbvh;
+    AABBTree<vRigidBody> m_aabbTree;
+    vector<int> m_proxy; //body id -> proxy in m_aabbTree
+    vector<std::pair<vRigidBody*, vRigidBody*>> m_pairs; //candidate pairs of the broad phase
     vector<vector<int>> colcheck;
     bool coltores = false;
     int m_ws;
 
+    //persistent contacts: resting pairs reuse the last solution instead of being evaluated again
+    bool warmStarting = true;
+    float restingTolerance = 0.001f;  //max relative motion (position, velocity, rotation) of a resting pair
+    int maxReuse = 8;                 //force a full evaluation every maxReuse steps
+
     CollisionSolver(const float &worldSize) //world center is implicit at 0 0 0
     {
         this->m_ws = worldSize;
         this->m_tree = new Octree<vRigidBody>(this->octreeCenter, this->m_ws*2.0f, this->octreeDepth);
+        this->m_looseTree = new LooseOctree<vRigidBody>(this->octreeCenter, this->m_ws*2.0f, this->octreeDepth);
+    }
+
+    ~CollisionSolver()
+    {
+        clearResp();
+        delete this->m_tree;
+        delete this->m_looseTree;
     }
 
+    CollisionSolver(const CollisionSolver&) = delete;
+
+    CollisionSolver& operator=(const CollisionSolver&) = delete;
+
     void setBodies(vector<vRigidBody*>* v)
     {
         this->m_rBodies = v;
@@ -46,11 +180,143 @@ class CollisionSolver
         delete m_tree;
         this->m_tree = new Octree<vRigidBody>(this->octreeCenter, this->m_ws*2.0f, this->octreeDepth);
 
+        delete m_looseTree;
+        this->m_looseTree = new LooseOctree<vRigidBody>(this->octreeCenter, this->m_ws*2.0f, this->octreeDepth);
+
         colcheck.clear();
         vector<vector<int>>().swap(colcheck);
 
         octreeLeafs.clear();
         vector<class Octree<vRigidBody>::OctreeNode*>().swap(octreeLeafs);
+
+        m_contacts.clear();
+        vector<unsigned>().swap(m_epoch);
+
+        m_aabbTree.clear();
+        vector<int>().swap(m_proxy);
+
+        m_staticTree.clear();
+        m_staticDirty = true;
+
+        //a new world starts with no contacts and no END events
+        m_touching.clear();
+        m_lastTouching.clear();
+        m_events.clear();
+        m_overlaps.clear();
+        m_lastOverlaps.clear();
+        m_triggerEvents.clear();
+    }
+
+    //fn(a, b, normal, point) for each pair touching in the last step
+    template <typename F>
+    void forEachContact(F fn)
+    {
+        for(auto it = this->m_contacts.begin(); it != this->m_contacts.end(); ++it)
+            if(it->second.step == this->m_step-1) fn(it->second.a, it->second.b, it->second.normal, it->second.point);
+    }
+
+    //a static body has been added (or changed type)
+    void markStaticDirty()
+    {
+        this->m_staticDirty = true;
+    }
+
+    //called before a body is deleted, O(1). the octrees, their leaf list and the candidate pairs
+    //keep the pointer until the next update rebuilds them, nothing reads their items in between
+    void removeBody(vRigidBody * rb)
+    {
+        if(rb->isStatic()) this->m_staticDirty = true;
+        if(rb->getId() < this->m_proxy.size() && this->m_proxy[rb->getId()] != -1)
+        {
+            this->m_aabbTree.destroyProxy(this->m_proxy[rb->getId()]);
+            this->m_proxy[rb->getId()] = -1;
+        }
+
+        //cached contacts of the body become invalid (the id will be recycled)
+        if(rb->getId() >= this->m_epoch.size()) this->m_epoch.resize(rb->getId()+1, 0);
+        this->m_epoch[rb->getId()]++;
+    }
+
+    //keep the contacts and the pairs of the last 'frames' frames (0 = none), for the rollback: a
+    //re-simulated step reuses the same contacts and reports the same events as the first time
+    void setHistory(int frames)
+    {
+        this->m_history.clear();
+        this->m_history.resize(frames);
+    }
+
+    void saveHistory(int frame)
+    {
+        if(this->m_history.empty()) return;
+        history &h = this->m_history[frame % this->m_history.size()];
+        h.frame = frame;
+        h.step = this->m_step;
+        //only the pairs of the last step, the others are evicted by the next one
+        h.contacts.clear();
+        for(auto it = this->m_contacts.begin(); it != this->m_contacts.end(); ++it)
+            if(it->second.step == this->m_step-1) h.contacts.push_back(*it);
+        h.particles.clear();
+        for(int i = 0; i < h.contacts.size(); i++)
+        {
+            const contact &c = h.contacts[i].second;
+            for(int k = 0; k < c.corrections.size(); k++)
+            {
+                vParticle * p = static_cast<vParticle*>(c.corrections[k].mov);
+                vRigidBody * rb = p->m_rbid == c.a->getId() ? c.a : c.b;
+                h.particles.push_back(std::make_pair(rb == c.a ? 0 : 1, (int)(p - &rb->getParticles()->at(0))));
+            }
+        }
+        h.pairs = this->m_touching;
+        h.overlaps = this->m_lastOverlaps;
+    }
+
+    //back to the history saved for 'frame', false (and no history) if it is not there
+    bool restoreHistory(int frame)
+    {
+        if(this->m_history.empty() || this->m_history[frame % this->m_history.size()].frame != frame)
+        {
+            resetHistory();
+            return false;
+        }
+        const history &h = this->m_history[frame % this->m_history.size()];
+        this->m_step = h.step;
+        this->m_contacts.clear();
+        int n = 0;
+        for(int i = 0; i < h.contacts.size(); i++)
+        {
+            contact &c = this->m_contacts[h.contacts[i].first];
+            c = h.contacts[i].second;
+            for(int k = 0; k < c.corrections.size(); k++, n++)
+                c.corrections[k].mov = &(h.particles[n].first == 0 ? c.a : c.b)->getParticles()->at(h.particles[n].second);
+        }
+        this->m_touching = h.pairs;
+        this->m_lastTouching.clear();
+        this->m_lastOverlaps = h.overlaps;
+        this->m_overlaps.clear();
+        this->m_events.clear();
+        this->m_triggerEvents.clear();
+
+        //the frames after it will be simulated again
+        for(int i = 0; i < this->m_history.size(); i++) if(this->m_history[i].frame > frame) this->m_history[i].frame = -1;
+        return true;
+    }
+
+    //no contacts and no pairs: the next step reports the pairs touching then as BEGIN
+    void resetHistory()
+    {
+        m_contacts.clear();
+        m_touching.clear();
+        m_lastTouching.clear();
+        m_events.clear();
+        m_overlaps.clear();
+        m_lastOverlaps.clear();
+        m_triggerEvents.clear();
+    }
+
+    //the bodies moved their particles: cached contacts point to the old ones
+    void relocateBodies()
+    {
+        m_contacts.clear();
     }
 
     void freeMemory()
@@ -63,9 +329,42 @@ class CollisionSolver
     {
         clearResp();
         freeMemory();
-        
+        this->m_ghostResponses.clear();
+
+        splitBodies();
+
+        if(this->broadPhase == OCTREE) updateOctree();
+        else updatePairs();
+
+        updateStatic();
+
+        resolveCollisions();
+        evictContacts();
+        if(this->contactEvents) updateEvents();
+        updateTriggerEvents();
+        this->m_step++;
+    }
+
+    //events of the last step, read in one go after vPhysics::step
+    vector<contactEvent>* getContactEvents()
+    {
+        return &this->m_events;
+    }
+
+    vector<triggerEvent>* getTriggerEvents()
+    {
+        return &this->m_triggerEvents;
+    }
+
+    vector<ghostResponse>* getGhostResponses()
+    {
+        return &this->m_ghostResponses;
+    }
+
+    void updateOctree()
+    {
         //update the tree
-        m_tree->updateTree(*m_rBodies);
+        m_tree->updateTree(m_dynamic);
         
         //we fetch the leafs of the tree (where rigidbodies are)
         //only leaf containing more than one rigidbody are returned 
@@ -84,19 +383,334 @@ class CollisionSolver
                 for(int k = j+1; k < octreeLeafs.at(i)->m_items.size(); k++)
                 {   //rigidbody B
                     pt_b = dynamic_cast<vRigidBody*>(octreeLeafs.at(i)->m_items.at(k));
-                    vec3 intersection;
+
+                    //layers, masks and groups before the deduplication
+                    if(!vRigidBody::canCollide(pt_a, pt_b)) continue;
             
                     if( canAddColl(Collision::genId(pt_a->getId(), pt_b->getId())) )
-                        if(vRigidBody::collide(pt_a, pt_b, intersection))
-                        {
-                            coltores = true;
-                            vector<int> df = Collision::genId(pt_a->getId(), pt_b->getId());
-                            addCollision(new Collision(pt_a, pt_b, intersection));
-                        }
+                        testPair(pt_a, pt_b);
                 }
             }
         }
-        resolveCollisions();
+    }
+
+    //every pair is reported once by the loose octree and the lbvh -> no deduplication
+    void updatePairs()
+    {
+        m_pairs.clear();
+        if(this->broadPhase == LOOSE_OCTREE)
+        {
+            m_looseTree->updateTree(m_dynamic);
+            m_looseTree->getPairs(m_pairs);
+        }
+        if(this->broadPhase == LBVH_TREE)
+        {
+            m_lbvh.updateTree(m_dynamic);
+            m_lbvh.getPairs(m_pairs);
+        }
+        if(this->broadPhase == AABB_TREE)
+        {
+            updateProxies();
+            m_aabbTree.getPairs(m_pairs);
+        }
+
+        for(int i = 0; i < m_pairs.size(); i++)
+            if(vRigidBody::canCollide(m_pairs[i].first, m_pairs[i].second)) testPair(m_pairs[i].first, m_pairs[i].second);
+    }
+
+    //static bodies go in the static tree, all the others in the dynamic broad phase
+    void splitBodies()
+    {
+        int statics = m_static.size();
+        m_dynamic.clear();
+        m_static.clear();
+        m_ghost.assign(m_ghost.size(), 0);
+        for(int i = 0; i < m_rBodies->size(); i++)
+        {
+            if(m_rBodies->at(i)->isStatic()) m_static.push_back(m_rBodies->at(i));
+            else m_dynamic.push_back(m_rBodies->at(i));
+
+            if(!m_rBodies->at(i)->isGhost()) continue;
+            int id = m_rBodies->at(i)->getId();
+            if(id >= m_ghost.size()) m_ghost.resize(id+1, 0);
+            m_ghost[id] = 1;
+        }
+        if(statics != m_static.size()) m_staticDirty = true;
+    }
+
+    //dynamic vs static pairs: each dynamic body queries the static tree
+    void updateStatic()
+    {
+        if(m_static.empty()) return;
+
+        if(m_staticDirty)
+        {
+            vec3 min, max;
+            m_staticTree.clear();
+            for(int i = 0; i < m_static.size(); i++)
+            {
+                m_static[i]->getBounds(min, max);
+                m_staticTree.createProxy(m_static[i], min, max);
+            }
+            m_staticDirty = false;
+        }
+
+        vec3 min, max;
+        for(int i = 0; i < m_dynamic.size(); i++)
+        {
+            if(!m_dynamic[i]->isDynamic()) continue;
+            m_dynamic[i]->getBounds(min, max);
+            m_staticHits.clear();
+            m_staticTree.query(min, max, m_staticHits);
+            for(int j = 0; j < m_staticHits.size(); j++)
+                if(vRigidBody::canCollide(m_dynamic[i], m_staticHits[j])) testPair(m_dynamic[i], m_staticHits[j]);
+        }
+    }
+
+    //create the proxies of the new bodies and move the others
+    void updateProxies()
+    {
+        vec3 min, max;
+        for(int i = 0; i < m_rBodies->size(); i++)
+        {
+            vRigidBody * rb = m_rBodies->at(i);
+            int id = rb->getId();
+            if(id >= m_proxy.size()) m_proxy.resize(id+1, -1);
+
+            //static bodies are not in the dynamic tree
+            if(rb->isStatic())
+            {
+                if(m_proxy[id] != -1) m_aabbTree.destroyProxy(m_proxy[id]);
+                m_proxy[id] = -1;
+                continue;
+            }
+
+            rb->getBounds(min, max);
+            if(m_proxy[id] == -1) m_proxy[id] = m_aabbTree.createProxy(rb, min, max);
+            else m_aabbTree.moveProxy(m_proxy[id], min, max, rb->getVelocity());
+        }
+    }
+
+    //narrow phase
+    void testPair(vRigidBody * a, vRigidBody * b)
+    {
+        //triggers run the boolean test only: no narrow phase, no responses
+        if(a->isTrigger() || b->isTrigger())
+        {
+            testTrigger(a, b);
+            return;
+        }
+
+        //nothing to push (kinematic vs kinematic)
+        if(!a->isDynamic() && !b->isDynamic()) return;
+
+        vec3 intersection;
+        if(vRigidBody::collide(a, b, intersection))
+        {
+            coltores = true;
+            solveContact(a, b, intersection);
+        }
+    }
+
+    //static bodies and other triggers never enter a trigger
+    void testTrigger(vRigidBody * a, vRigidBody * b)
+    {
+        if(a->isTrigger() == b->isTrigger()) return;
+        if(b->isTrigger()) std::swap(a, b);
+        if(b->isStatic() || !vRigidBody::overlap(a, b)) return;
+
+        overlap o;
+        o.key = Collision::genKey(a->getId(), b->getId());
+        o.trigger = a->getId();
+        o.other = b->getId();
+        o.epochTrigger = epoch(a->getId());
+        o.epochOther = epoch(b->getId());
+        this->m_overlaps.push_back(o);
+    }
+
+    //evaluate the collision of a touching pair, or reuse the last solution if the pair is resting
+    void solveContact(vRigidBody * a, vRigidBody * b, vec3 intersection)
+    {
+        contact &c = this->m_contacts[Collision::genKey(a->getId(), b->getId())];
+
+        if(this->warmStarting && isResting(c, a, b))
+        {
+            c.step = this->m_step;
+            c.reused++;
+            collisionId.push_back( Collision::genId( a->getId(), b->getId() ) );
+            for(int i = 0; i < c.corrections.size(); i++)
+            {
+                const contact::correction &k = c.corrections[i];
+                addResponse(new Response(k.id, k.mov, k.mov->getPosition()+k.dPos, k.mov->getLastPosition()+k.dOld));
+            }
+            return;
+        }
+
+        Collision * col = new Collision(a, b, intersection);
+
+        c.step = this->m_step;
+        c.a = a;
+        c.b = b;
+        c.epochA = epoch(a->getId());
+        c.epochB = epoch(b->getId());
+        c.refA = a->getPosition();
+        c.refB = b->getPosition();
+        c.axisA = a->getXAxis();
+        c.axisB = b->getXAxis();
+        c.normal = col->normal;
+        c.point = col->point;
+        c.reused = 0;
+        c.corrections.clear();
+        for(int i = 0; i < col->getResponses().size(); i++)
+        {
+            Response * r = col->getResponses().at(i);
+            c.corrections.push_back(contact::correction{
+                r->getId(),
+                r->getMovable(),
+                r->getPosition() - r->getMovable()->getPosition(),
+                r->getLastPosition() - r->getMovable()->getLastPosition()
+            });
+        }
+        c.impulse = impulse(c);
+
+        addCollision(col);
+    }
+
+    //the pair was touching in the previous step and barely moved since it was evaluated
+    bool isResting(const contact &c, vRigidBody * a, vRigidBody * b)
+    {
+        if(c.step != this->m_step-1 || c.reused >= this->maxReuse) return false;
+        if(c.a == b) std::swap(a, b);
+        if(c.a != a || c.b != b) return false;
+        if(c.epochA != epoch(a->getId()) || c.epochB != epoch(b->getId())) return false;
+
+        float t = this->restingTolerance;
+        if(glm::length((a->getPosition()-b->getPosition()) - (c.refA-c.refB)) > t) return false;
+        if(glm::length(a->getVelocity()-b->getVelocity()) > t) return false;
+        if(glm::length(a->getXAxis()-c.axisA) > t || glm::length(b->getXAxis()-c.axisB) > t) return false;
+        return true;
+    }
+
+    //momentum the corrections give to each body, the bigger one
+    float impulse(const contact &c)
+    {
+        vec3 pa(.0f, .0f, .0f), pb(.0f, .0f, .0f);
+        for(int i = 0; i < c.corrections.size(); i++)
+        {
+            const contact::correction &k = c.corrections[i];
+            vParticle * p = static_cast<vParticle*>(k.mov);
+            if(p->getDt() <= .0f) continue;
+            vec3 dp = p->getMass() * (k.dPos - k.dOld) / p->getDt();
+            if(p->m_rbid == c.a->getId()) pa += dp;
+            else pb += dp;
+        }
+        return std::max(glm::length(pa), glm::length(pb));
+    }
+
+    //sorted pairs of this step merged with the ones of the previous step:
+    //only now -> BEGIN, in both -> PERSIST, only before -> END
+    void updateEvents()
+    {
+        this->m_events.clear();
+        this->m_lastTouching.swap(this->m_touching);
+        this->m_touching.clear();
+
+        for(auto it = this->m_contacts.begin(); it != this->m_contacts.end(); ++it)
+        {
+            const contact &c = it->second;
+            touching t;
+            t.key = it->first;
+            t.a = c.a->getId();
+            t.b = c.b->getId();
+            t.epochA = c.epochA;
+            t.epochB = c.epochB;
+            t.normal = c.normal;
+            if(t.a > t.b) { std::swap(t.a, t.b); std::swap(t.epochA, t.epochB); t.normal = -t.normal; }
+            t.point = c.point;
+            t.impulse = c.impulse;
+            this->m_touching.push_back(t);
+        }
+        std::sort(this->m_touching.begin(), this->m_touching.end(), [](const touching &x, const touching &y) { return x.key < y.key; });
+
+        const vector<touching> &now = this->m_touching, &last = this->m_lastTouching;
+        int i = 0, j = 0;
+        while(i < now.size() || j < last.size())
+        {
+            if(j == last.size() || (i < now.size() && now[i].key < last[j].key)) addEvent(contactEvent::BEGIN, now[i++]);
+            else if(i == now.size() || last[j].key < now[i].key) addEvent(contactEvent::END, last[j++]);
+            //same ids but one of the bodies has been removed and its id recycled
+            else if(now[i].epochA != last[j].epochA || now[i].epochB != last[j].epochB)
+            {
+                addEvent(contactEvent::END, last[j++]);
+                addEvent(contactEvent::BEGIN, now[i++]);
+            }
+            else
+            {
+                addEvent(contactEvent::PERSIST, now[i++]);
+                j++;
+            }
+        }
+    }
+
+    //same merge as the contacts, the octree can report a pair more than once
+    void updateTriggerEvents()
+    {
+        this->m_triggerEvents.clear();
+        std::sort(this->m_overlaps.begin(), this->m_overlaps.end(), [](const overlap &x, const overlap &y) { return x.key < y.key; });
+        this->m_overlaps.erase(std::unique(this->m_overlaps.begin(), this->m_overlaps.end(), [](const overlap &x, const overlap &y) { return x.key == y.key; }), this->m_overlaps.end());
+
+        const vector<overlap> &now = this->m_overlaps, &last = this->m_lastOverlaps;
+        int i = 0, j = 0;
+        while(i < now.size() || j < last.size())
+        {
+            if(j == last.size() || (i < now.size() && now[i].key < last[j].key)) addTriggerEvent(triggerEvent::ENTER, now[i++]);
+            else if(i == now.size() || last[j].key < now[i].key) addTriggerEvent(triggerEvent::EXIT, last[j++]);
+            else if(now[i].epochTrigger != last[j].epochTrigger || now[i].epochOther != last[j].epochOther)
+            {
+                addTriggerEvent(triggerEvent::EXIT, last[j++]);
+                addTriggerEvent(triggerEvent::ENTER, now[i++]);
+            }
+            else { i++; j++; }
+        }
+
+        this->m_lastOverlaps.swap(this->m_overlaps);
+        this->m_overlaps.clear();
+    }
+
+    void addTriggerEvent(triggerEvent::Type type, const overlap &o)
+    {
+        triggerEvent e;
+        e.type = type;
+        e.trigger = o.trigger;
+        e.other = o.other;
+        this->m_triggerEvents.push_back(e);
+    }
+
+    void addEvent(contactEvent::Type type, const touching &t)
+    {
+        contactEvent e;
+        e.type = type;
+        e.a = t.a;
+        e.b = t.b;
+        e.normal = t.normal;
+        e.point = t.point;
+        e.impulse = type == contactEvent::END ? .0f : t.impulse;
+        this->m_events.push_back(e);
+    }
+
+    //drop the pairs that are not touching anymore
+    void evictContacts()
+    {
+        for(auto it = this->m_contacts.begin(); it != this->m_contacts.end(); )
+        {
+            if(it->second.step != this->m_step) it = this->m_contacts.erase(it);
+            else ++it;
+        }
+    }
+
+    unsigned epoch(int id)
+    {
+        return id < this->m_epoch.size() ? this->m_epoch[id] : 0;
     }
 
     bool canAddColl(vector<int> col_id)
@@ -117,12 +731,15 @@ class CollisionSolver
     void addResponses(Collision c)
     { //TO OPTIMIZE (sort indexes? )
         for(int i = 0; i < c.getResponses().size(); i++)
-        {
-            for(int j = 0; j < resp.size(); j++)
-                if(c.getResponses().at(i)->getId() == resp.at(j)->getId() )
-                    resp.at(j)->update(c.getResponses().at(i));
-            resp.push_back(c.getResponses().at(i));
-        }
+            addResponse(c.getResponses().at(i));
+    }
+
+    void addResponse(Response * r)
+    {
+        for(int j = 0; j < resp.size(); j++)
+            if(r->getId() == resp.at(j)->getId() )
+                resp.at(j)->update(r);
+        resp.push_back(r);
     }
 
     void resolveCollisions()
@@ -132,6 +749,13 @@ class CollisionSolver
         for_each(resp.begin(), resp.end(),
             [&](Response* r)
             {
+                int id = r->getId().at(0);
+                if(id < m_ghost.size() && m_ghost[id])
+                {
+                    Movable * m = r->getMovable();
+                    m_ghostResponses.push_back(ghostResponse{ id, r->getId().at(1), r->getPosition() - m->getPosition(), r->getLastPosition() - m->getLastPosition() });
+                    return;
+                }
                 r->apply();
             });
         clearResp();
@@ -140,6 +764,7 @@ class CollisionSolver
 
     void clearResp()
     {
+        for(int i = 0; i < resp.size(); i++) delete resp[i];
         vector<Response*>().swap(resp);
         vector<vector<int>>().swap(collisionId);
     }
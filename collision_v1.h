@@ -12,12 +12,13 @@ Real-Time Graphics Programming's Project - 2019/2020
 #include <physics/response_v1.h>
 #include <physics/tools_v1.h>
 
-class Collision
+class Collision : public vTracked<MEMORY_CONTACTS>
 {
     public:
     vRigidBody *pt_a, *pt_b;
 
-    vec3 normal;
+    vec3 normal; //from B to A (average of the normals found by evaluate)
+    vec3 point; //contact point (average of the intersections found by evaluate)
     vector<int> m_id;
     vector<int> apId, bpId ; //particle's ID of A, B
     vector<vec3> apPos, bpPos; //new Position of particles A, B
@@ -30,12 +31,32 @@ class Collision
         this->pt_b = b;
         this->normal = n;
         this->m_id = genId(pt_a->getId(), pt_b->getId());
+        this->point = vec3(.0f, .0f, .0f);
+        this->m_points = 0;
+        this->m_normalSum = vec3(.0f, .0f, .0f);
 
         //std::cout << "\t\tCOLLISION - EVALUATE" << std::endl;
         evaluate();
+
+        if(glm::length(this->m_normalSum) > .0f) this->normal = glm::normalize(this->m_normalSum);
     }
 
     private:
+    int m_points;
+    vec3 m_normalSum;
+
+    void addPoint(vec3 p)
+    {
+        this->m_points++;
+        this->point += (p - this->point) / (float)this->m_points;
+    }
+
+    //the normals of both bodies are turned to point A
+    void addNormal(vec3 n)
+    {
+        if(glm::dot(n, this->pt_a->getPosition() - this->pt_b->getPosition()) < .0f) n = -n;
+        this->m_normalSum += n;
+    }
 
     struct triangleResp
     {
@@ -117,8 +138,11 @@ class Collision
                         //this method dosen't fit
                         //it dosen't take into consideration angular velocity 
 
+                        addPoint(intersection);
+                        addNormal(vRigidBody::triangle::getNormal(tris.at(j)));
+
                         reflectpatricle( a_out, ao_out, p_pos, rb_a->getParticles()->at(i).getLastPosition(),
-                                rb_a->getMass(), rb_b->getVelocity(), rb_b->getMass(),
+                                rb_a->getMass(), rb_b->getVelocity(), rb_b->getEffectiveMass(),
                                 intersection, vRigidBody::triangle::getNormal(tris.at(j))
                         );
                             
@@ -149,6 +173,7 @@ class Collision
     }
 
 
+    public:
     //this method will calculate the new state of patricle A after hitting a rigidbody B
     // out_pos = A post collision position
     // out_last_pos = A post collision last frame position
@@ -168,8 +193,9 @@ class Collision
         vec3 vel_a = pos - last_pos;
         //compute the normal velocity using relative velocity (vel_a - vel_b)
         vec3 vel_norm = glm::dot( vel_a - vel_b, normal ) * normal;
-        //compute velocity post collision respect to mass
-        vec3 vel_a1 = vel_a - ( 2.0f * mass_b / ( mass_a + mass_b ) ) * vel_norm;
+        //compute velocity post collision respect to mass (B may have infinite mass -> pure reflection)
+        float k = std::isinf(mass_b) ? 2.0f : 2.0f * mass_b / ( mass_a + mass_b );
+        vec3 vel_a1 = vel_a - k * vel_norm;
         //compute the adjust factor
         float s = glm::length(pos-pos1);
 
@@ -178,6 +204,8 @@ class Collision
         out_last_pos = out_pos - vel_a1;
     }
 
+    private:
+
     /*
     
     OLD EVALUATE METHOD A LITTE BIT MORE PRECISE DUE TO THE COLLISION NORMAL CALCULATED AFTER ADJUSTED THE CENTER OF THE PATRICLE IN A VALID POSITION
@@ -273,18 +301,20 @@ class Collision
         a_pos = rb_a->getPosition();
         a_last = rb_a->getLastPosition();
         a_radius = rb_a->getRadius();
-        a_mass = rb_a->getMass();
+        a_mass = rb_a->getEffectiveMass();
 
         b_pos = rb_b->getPosition();
         b_last = rb_b->getLastPosition();
         b_radius = rb_b->getRadius();
-        b_mass = rb_b->getMass();
+        b_mass = rb_b->getEffectiveMass();
         
 
         //compute normals & intesection point
         vec3 a_normal = glm::normalize( a_pos - b_pos );
         vec3 b_normal = glm::normalize( b_pos - a_pos );
         vec3 intersection = b_pos + a_normal * b_radius;
+        addPoint(intersection);
+        addNormal(a_normal);
 
 
         //the following method will put the result in these variables
@@ -314,27 +344,31 @@ class Collision
                     b_radius
                     );
 
-        resp.push_back(new Response(
-            Response::genId(rb_b->getId(), 0 ), //in sphere there is only one patricle, thus id is always 0
-            &rb_b->getParticles()->at(0),
-            b,
-            ob
-        ));
-
-        resp.push_back(new Response(
-            Response::genId(rb_a->getId(), 0 ), //in sphere there is only one patricle, thus id is always 0
-            &rb_a->getParticles()->at(0),
-            a,
-            oa
-        ));
+        //kinematic and static bodies are never pushed (ghosts get a response, the solver hands it out)
+        if(rb_b->isDynamic() || rb_b->isGhost())
+            resp.push_back(new Response(
+                Response::genId(rb_b->getId(), 0 ), //in sphere there is only one patricle, thus id is always 0
+                &rb_b->getParticles()->at(0),
+                b,
+                ob
+            ));
+
+        if(rb_a->isDynamic() || rb_a->isGhost())
+            resp.push_back(new Response(
+                Response::genId(rb_a->getId(), 0 ), //in sphere there is only one patricle, thus id is always 0
+                &rb_a->getParticles()->at(0),
+                a,
+                oa
+            ));
     }
 
     void evaluate()
     {
         if ( this->pt_a->isBox() && this->pt_b->isBox() )
         {
-            evaluate(dynamic_cast<Box*>(this->pt_a), dynamic_cast<Box*>(this->pt_b));
-            evaluate(dynamic_cast<Box*>(this->pt_b), dynamic_cast<Box*>(this->pt_a));
+            //kinematic and static bodies are never pushed
+            if(this->pt_a->isDynamic() || this->pt_a->isGhost()) evaluate(dynamic_cast<Box*>(this->pt_a), dynamic_cast<Box*>(this->pt_b));
+            if(this->pt_b->isDynamic() || this->pt_b->isGhost()) evaluate(dynamic_cast<Box*>(this->pt_b), dynamic_cast<Box*>(this->pt_a));
         }
         if ( this->pt_a->isSphere() && this->pt_b->isSphere() )
         {
@@ -368,6 +402,13 @@ class Collision
     {
             return m_id;
     }
+
+    //order independent key of the pair (a, b)
+    static unsigned long long genKey(int a, int b)
+    {
+        if(a < b) std::swap(a, b);
+        return ((unsigned long long)(unsigned)a << 32) | (unsigned)b;
+    }
 }; 
 
 
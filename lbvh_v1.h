@@ -0,0 +1,318 @@
+/*
+PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+#include <physics/tools_v1.h>
+#include <physics/memory_v1.h>
+#include <physics/thread_pool_v1.h>
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <atomic>
+#include <cfloat>
+#include <mutex>
+#include <algorithm>
+#include <utility>
+
+using std::vector;
+
+//Linear BVH built from Morton codes (Karras, "Maximizing Parallelism in the Construction of BVHs").
+//The centers of the items are turned into Morton codes and radix sorted, then every internal node
+//is computed independently from the sorted keys. Each step of the build is a parallel loop.
+//T must implement getPosition() and getBoundingRadius() (see OItem).
+template <class T> class LBVH
+{
+public:
+    struct node
+    {
+        vec3 min, max;
+        int left, right;            //children: index of an internal node or of a leaf
+        bool leftLeaf, rightLeaf;
+        int first, last;            //range of leafs under the node
+        int parent;
+    };
+
+    vTaggedVector<T*, MEMORY_OCTREE> m_items;           //sorted along the Morton curve
+    vTaggedVector<vec3, MEMORY_OCTREE> m_min, m_max;    //bounds of the sorted items
+    vTaggedVector<node, MEMORY_OCTREE> m_nodes;         //n-1 internal nodes, root is 0
+    vTaggedVector<int, MEMORY_OCTREE> m_leafParent;
+
+private:
+    vTaggedVector<vec3, MEMORY_OCTREE> m_center;
+    vTaggedVector<float, MEMORY_OCTREE> m_radius;
+    vTaggedVector<unsigned int, MEMORY_OCTREE> m_keys, m_tmpKeys;
+    vTaggedVector<int, MEMORY_OCTREE> m_index, m_tmpIndex;
+    vTaggedVector<std::atomic<int>, MEMORY_OCTREE> m_visits;
+
+    vThreadPool * m_pool;
+    int m_grain;
+
+public:
+    LBVH(vThreadPool * pool = &vThreadPool::global(), int grain = 256)
+    {
+        m_pool = pool;
+        m_grain = grain;
+    }
+
+    int size()
+    {
+        return m_items.size();
+    }
+
+    void updateTree(vector<T*> &items)
+    {
+        int n = items.size();
+        resize(n);
+        if(n == 0) return;
+
+        //1 - bounds of the items and of the scene
+        vec3 sceneMin(FLT_MAX, FLT_MAX, FLT_MAX), sceneMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        std::mutex merge;
+        m_pool->parallelFor(n, [&](int begin, int end)
+        {
+            vec3 lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+            for(int i = begin; i < end; i++)
+            {
+                m_center[i] = items[i]->getPosition();
+                m_radius[i] = items[i]->getBoundingRadius();
+                lo = glm::min(lo, m_center[i]);
+                hi = glm::max(hi, m_center[i]);
+            }
+            std::lock_guard<std::mutex> lock(merge);
+            sceneMin = glm::min(sceneMin, lo);
+            sceneMax = glm::max(sceneMax, hi);
+        }, m_grain);
+
+        //2 - Morton codes of the centers
+        vec3 extent = sceneMax - sceneMin;
+        vec3 scale(extent.x > 0 ? 1.0f/extent.x : 0, extent.y > 0 ? 1.0f/extent.y : 0, extent.z > 0 ? 1.0f/extent.z : 0);
+        m_pool->parallelFor(n, [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++)
+            {
+                m_keys[i] = morton3D((m_center[i] - sceneMin) * scale);
+                m_index[i] = i;
+            }
+        }, m_grain);
+
+        //3 - sort
+        radixSort(n);
+
+        m_pool->parallelFor(n, [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++)
+            {
+                int k = m_index[i];
+                m_items[i] = items[k];
+                m_min[i] = m_center[k] - vec3(m_radius[k], m_radius[k], m_radius[k]);
+                m_max[i] = m_center[k] + vec3(m_radius[k], m_radius[k], m_radius[k]);
+            }
+        }, m_grain);
+
+        if(n < 2) return;
+
+        //4 - hierarchy, each internal node only depends on the sorted keys
+        m_leafParent[0] = -1;
+        m_nodes[0].parent = -1;
+        m_pool->parallelFor(n-1, [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++) buildNode(i, n);
+        }, m_grain);
+
+        //5 - bounds, bottom up: the second child reaching a node computes it
+        m_pool->parallelFor(n-1, [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++) m_visits[i].store(0, std::memory_order_relaxed);
+        }, m_grain);
+
+        m_pool->parallelFor(n, [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++)
+            {
+                int p = m_leafParent[i];
+                while(p != -1)
+                {
+                    if(m_visits[p].fetch_add(1, std::memory_order_acq_rel) == 0) break;
+                    node &nd = m_nodes[p];
+                    nd.min = glm::min(nd.leftLeaf ? m_min[nd.left] : m_nodes[nd.left].min,
+                                      nd.rightLeaf ? m_min[nd.right] : m_nodes[nd.right].min);
+                    nd.max = glm::max(nd.leftLeaf ? m_max[nd.left] : m_nodes[nd.left].max,
+                                      nd.rightLeaf ? m_max[nd.right] : m_nodes[nd.right].max);
+                    p = nd.parent;
+                }
+            }
+        }, m_grain);
+    }
+
+    //every pair of items whose bounds overlap, reported once and always in the same order
+    void getPairs(vector<std::pair<T*, T*>> &result)
+    {
+        int n = m_items.size();
+        if(n < 2) return;
+
+        vector<std::pair<int, vector<std::pair<T*, T*>>>> chunks;
+        std::mutex merge;
+        m_pool->parallelFor(n, [&](int begin, int end)
+        {
+            vector<std::pair<T*, T*>> local;
+            vector<int> stack;
+            for(int i = begin; i < end; i++) query(i, stack, local);
+
+            std::lock_guard<std::mutex> lock(merge);
+            chunks.push_back(std::make_pair(begin, vector<std::pair<T*, T*>>()));
+            chunks.back().second.swap(local);
+        }, m_grain);
+
+        std::sort(chunks.begin(), chunks.end(),
+            [](const std::pair<int, vector<std::pair<T*, T*>>> &a, const std::pair<int, vector<std::pair<T*, T*>>> &b) { return a.first < b.first; });
+        for(int i = 0; i < chunks.size(); i++)
+            result.insert(result.end(), chunks[i].second.begin(), chunks[i].second.end());
+    }
+
+private:
+    void resize(int n)
+    {
+        m_items.resize(n);
+        m_min.resize(n);
+        m_max.resize(n);
+        m_center.resize(n);
+        m_radius.resize(n);
+        m_keys.resize(n);
+        m_tmpKeys.resize(n);
+        m_index.resize(n);
+        m_tmpIndex.resize(n);
+        m_leafParent.resize(n);
+        m_nodes.resize(n > 1 ? n-1 : 0);
+        if(m_visits.size() < m_nodes.size()) vTaggedVector<std::atomic<int>, MEMORY_OCTREE>(m_nodes.size()).swap(m_visits);
+    }
+
+    //LSD radix sort of (key, index), 8 bits per pass. each block of keys is histogrammed and
+    //scattered by one task, the offsets of the blocks are a serial prefix sum
+    void radixSort(int n)
+    {
+        int blocks = m_pool->size();
+        int blockSize = (n + blocks - 1) / blocks;
+        vector<int> offsets(blocks * 256);
+
+        for(int shift = 0; shift < 32; shift += 8)
+        {
+            std::fill(offsets.begin(), offsets.end(), 0);
+
+            m_pool->parallelFor(blocks, [&](int begin, int end)
+            {
+                for(int b = begin; b < end; b++)
+                    for(int i = b*blockSize; i < n && i < (b+1)*blockSize; i++)
+                        offsets[((m_keys[i] >> shift) & 0xFF) * blocks + b]++;
+            }, 1);
+
+            int sum = 0;
+            for(int i = 0; i < offsets.size(); i++)
+            {
+                int c = offsets[i];
+                offsets[i] = sum;
+                sum += c;
+            }
+
+            m_pool->parallelFor(blocks, [&](int begin, int end)
+            {
+                for(int b = begin; b < end; b++)
+                    for(int i = b*blockSize; i < n && i < (b+1)*blockSize; i++)
+                    {
+                        int o = offsets[((m_keys[i] >> shift) & 0xFF) * blocks + b]++;
+                        m_tmpKeys[o] = m_keys[i];
+                        m_tmpIndex[o] = m_index[i];
+                    }
+            }, 1);
+
+            m_keys.swap(m_tmpKeys);
+            m_index.swap(m_tmpIndex);
+        }
+    }
+
+    //length of the common prefix of keys i and j, equal keys are told apart by their position
+    int delta(int i, int j, int n)
+    {
+        if(j < 0 || j >= n) return -1;
+        unsigned int a = m_keys[i], b = m_keys[j];
+        if(a == b) return 32 + countLeadingZeros((unsigned int)i ^ (unsigned int)j);
+        return countLeadingZeros(a ^ b);
+    }
+
+    void buildNode(int i, int n)
+    {
+        //direction of the range
+        int d = (delta(i, i+1, n) - delta(i, i-1, n)) >= 0 ? 1 : -1;
+
+        //upper bound of the range length
+        int dmin = delta(i, i-d, n);
+        int lmax = 2;
+        while(delta(i, i + lmax*d, n) > dmin) lmax *= 2;
+
+        //other end of the range
+        int l = 0;
+        for(int t = lmax/2; t >= 1; t /= 2)
+            if(delta(i, i + (l+t)*d, n) > dmin) l += t;
+        int j = i + l*d;
+
+        //split position
+        int dnode = delta(i, j, n);
+        int s = 0;
+        int t = l;
+        do
+        {
+            t = (t + 1) / 2;
+            if(delta(i, i + (s+t)*d, n) > dnode) s += t;
+        } while(t > 1);
+        int gamma = i + s*d + (d < 0 ? d : 0);
+
+        node &nd = m_nodes[i];
+        nd.first = i < j ? i : j;
+        nd.last = i < j ? j : i;
+        nd.left = gamma;
+        nd.right = gamma+1;
+        nd.leftLeaf = nd.first == gamma;
+        nd.rightLeaf = nd.last == gamma+1;
+
+        if(nd.leftLeaf) m_leafParent[gamma] = i; else m_nodes[gamma].parent = i;
+        if(nd.rightLeaf) m_leafParent[gamma+1] = i; else m_nodes[gamma+1].parent = i;
+    }
+
+    static bool overlap(const vec3 &amin, const vec3 &amax, const vec3 &bmin, const vec3 &bmax)
+    {
+        return amin.x <= bmax.x && amax.x >= bmin.x &&
+               amin.y <= bmax.y && amax.y >= bmin.y &&
+               amin.z <= bmax.z && amax.z >= bmin.z;
+    }
+
+    //leafs after i overlapping leaf i
+    void query(int i, vector<int> &stack, vector<std::pair<T*, T*>> &result)
+    {
+        const vec3 &lo = m_min[i], &hi = m_max[i];
+        stack.clear();
+        stack.push_back(0);
+        while(!stack.empty())
+        {
+            const node &nd = m_nodes[stack.back()];
+            stack.pop_back();
+            if(nd.last <= i || !overlap(lo, hi, nd.min, nd.max)) continue;
+
+            if(nd.leftLeaf)
+            {
+                if(nd.left > i && overlap(lo, hi, m_min[nd.left], m_max[nd.left])) result.push_back(std::make_pair(m_items[i], m_items[nd.left]));
+            }
+            else stack.push_back(nd.left);
+
+            if(nd.rightLeaf)
+            {
+                if(nd.right > i && overlap(lo, hi, m_min[nd.right], m_max[nd.right])) result.push_back(std::make_pair(m_items[i], m_items[nd.right]));
+            }
+            else stack.push_back(nd.right);
+        }
+    }
+};
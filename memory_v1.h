@@ -0,0 +1,423 @@
+/*
+PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <cstddef>
+#include <initializer_list>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+//Memory accounting of the engine. The bodies, their particles and connections, the particle
+//systems and soft bodies, the broad phase trees, the contacts and the responses are allocated
+//through vMemory::global(), each with its tag. For every tag it counts the live bytes, the peak
+//and the allocations per step, and with the leak check on it remembers every block so the ones
+//still alive can be listed when the last world is destroyed (or at any time with checkLeaks).
+//The blocks come from a vAllocator, by default the global operator new; setAllocator plugs
+//in another one (pool, arena, ...).
+
+enum vMemoryTag
+{
+    MEMORY_BODIES,
+    MEMORY_PARTICLES,
+    MEMORY_CONNECTIONS,
+    MEMORY_OCTREE,
+    MEMORY_CONTACTS,
+    MEMORY_RESPONSES,
+    MEMORY_TAGS
+};
+
+//must return memory aligned as alignof(std::max_align_t), or NULL when out of memory.
+//called from any thread (bodies are built in parallel)
+class vAllocator
+{
+public:
+    virtual ~vAllocator() {}
+    virtual void* allocate(size_t bytes, vMemoryTag tag) = 0;
+    virtual void deallocate(void * p, size_t bytes, vMemoryTag tag) = 0;
+};
+
+class vHeapAllocator : public vAllocator
+{
+public:
+    void* allocate(size_t bytes, vMemoryTag tag)
+    {
+        return ::operator new(bytes, std::nothrow);
+    }
+
+    void deallocate(void * p, size_t bytes, vMemoryTag tag)
+    {
+        ::operator delete(p);
+    }
+};
+
+class vMemory
+{
+public:
+    struct stats
+    {
+        long long liveBytes = 0;
+        long long peakBytes = 0;
+        long long liveBlocks = 0;
+        long long allocations = 0;      //since the start
+        long long stepAllocations = 0;  //between the end of the last two steps
+    };
+
+private:
+    struct counters
+    {
+        std::atomic<long long> liveBytes{0}, peakBytes{0}, liveBlocks{0}, allocations{0};
+        std::atomic<long long> stepMark{0}, stepAllocations{0};
+    };
+
+    struct block
+    {
+        vMemoryTag tag;
+        size_t bytes;
+        long long number; //n-th allocation of the tag
+    };
+
+    vHeapAllocator m_heap;
+    vAllocator * m_allocator;
+    counters m_counters[MEMORY_TAGS+1]; //the last one is the total
+
+    std::atomic<bool> m_leakCheck{false};
+    std::mutex m_blocksMutex;
+    std::unordered_map<void*, block> m_blocks;
+
+    std::atomic<int> m_worlds{0};
+
+    vMemory()
+    {
+        this->m_allocator = &this->m_heap;
+    }
+
+public:
+    //never destroyed, worlds living in static objects can still free their memory at exit
+    static vMemory& global()
+    {
+        static vMemory * memory = new vMemory();
+        return *memory;
+    }
+
+    vMemory(const vMemory&) = delete;
+
+    vMemory& operator=(const vMemory&) = delete;
+
+    static const char* getName(vMemoryTag tag)
+    {
+        static const char * names[MEMORY_TAGS+1] = { "bodies", "particles", "connections", "octree", "contacts", "responses", "total" };
+        return names[tag];
+    }
+
+    //NULL goes back to the heap. the allocator can be changed only while nothing is allocated,
+    //a block must go back to the allocator it came from
+    bool setAllocator(vAllocator * allocator)
+    {
+        if(this->m_counters[MEMORY_TAGS].liveBlocks.load() != 0)
+        {
+            std::cout << "verlet memory -> can't change the allocator, " << this->m_counters[MEMORY_TAGS].liveBlocks.load() << " blocks are still alive" << std::endl;
+            return false;
+        }
+        this->m_allocator = allocator ? allocator : &this->m_heap;
+        return true;
+    }
+
+    vAllocator* getAllocator() { return this->m_allocator; }
+
+    void* allocate(vMemoryTag tag, size_t bytes)
+    {
+        void * p = this->m_allocator->allocate(bytes, tag);
+        if(p == NULL) throw std::bad_alloc();
+
+        long long number = 0;
+        for(int c : { (int)tag, (int)MEMORY_TAGS })
+        {
+            counters &k = this->m_counters[c];
+            long long live = k.liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+            long long peak = k.peakBytes.load(std::memory_order_relaxed);
+            while(live > peak && !k.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+            k.liveBlocks.fetch_add(1, std::memory_order_relaxed);
+            long long n = k.allocations.fetch_add(1, std::memory_order_relaxed);
+            if(c == tag) number = n;
+        }
+
+        if(this->m_leakCheck.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> lock(this->m_blocksMutex);
+            this->m_blocks[p] = block{ tag, bytes, number };
+        }
+        return p;
+    }
+
+    void deallocate(vMemoryTag tag, void * p, size_t bytes)
+    {
+        if(p == NULL) return;
+        for(int c : { (int)tag, (int)MEMORY_TAGS })
+        {
+            this->m_counters[c].liveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+            this->m_counters[c].liveBlocks.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        if(this->m_leakCheck.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> lock(this->m_blocksMutex);
+            this->m_blocks.erase(p);
+        }
+        this->m_allocator->deallocate(p, bytes, tag);
+    }
+
+    //MEMORY_TAGS for the total
+    stats getStats(vMemoryTag tag)
+    {
+        const counters &k = this->m_counters[tag];
+        stats s;
+        s.liveBytes = k.liveBytes.load(std::memory_order_relaxed);
+        s.peakBytes = k.peakBytes.load(std::memory_order_relaxed);
+        s.liveBlocks = k.liveBlocks.load(std::memory_order_relaxed);
+        s.allocations = k.allocations.load(std::memory_order_relaxed);
+        s.stepAllocations = k.stepAllocations.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    //called by vPhysics at the end of each step. the counters are shared by all the worlds:
+    //with more worlds the allocations of a step include the ones of the others
+    void endStep()
+    {
+        for(int c = 0; c <= MEMORY_TAGS; c++)
+        {
+            counters &k = this->m_counters[c];
+            long long now = k.allocations.load(std::memory_order_relaxed);
+            k.stepAllocations.store(now - k.stepMark.exchange(now, std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+
+    //only the blocks allocated while the check is on are tracked
+    void setLeakCheck(bool on)
+    {
+        std::lock_guard<std::mutex> lock(this->m_blocksMutex);
+        this->m_leakCheck.store(on);
+        if(!on) this->m_blocks.clear();
+    }
+
+    bool isLeakCheck() { return this->m_leakCheck.load(); }
+
+    //prints the tracked blocks still alive, returns how many they are
+    int checkLeaks(int maxListed = 16)
+    {
+        std::lock_guard<std::mutex> lock(this->m_blocksMutex);
+        if(this->m_blocks.empty()) return 0;
+
+        long long count[MEMORY_TAGS] = {}, bytes[MEMORY_TAGS] = {};
+        for(std::unordered_map<void*, block>::iterator it = this->m_blocks.begin(); it != this->m_blocks.end(); ++it)
+        {
+            count[it->second.tag]++;
+            bytes[it->second.tag] += it->second.bytes;
+        }
+
+        std::cout << "verlet memory -> " << this->m_blocks.size() << " blocks still alive" << std::endl;
+        for(int t = 0; t < MEMORY_TAGS; t++)
+            if(count[t] > 0) std::cout << "\t" << getName((vMemoryTag)t) << ": " << count[t] << " blocks, " << bytes[t] << " bytes" << std::endl;
+
+        int listed = 0;
+        for(std::unordered_map<void*, block>::iterator it = this->m_blocks.begin(); it != this->m_blocks.end() && listed < maxListed; ++it, listed++)
+            std::cout << "\t" << it->first << " " << getName(it->second.tag) << " #" << it->second.number << " (" << it->second.bytes << " bytes)" << std::endl;
+        return this->m_blocks.size();
+    }
+
+    void print()
+    {
+        std::cout << std::left << std::setw(14) << "tag" << std::right << std::setw(14) << "live bytes" << std::setw(14) << "peak bytes"
+                  << std::setw(12) << "blocks" << std::setw(14) << "allocations" << std::setw(12) << "per step" << std::endl;
+        for(int t = 0; t <= MEMORY_TAGS; t++)
+        {
+            stats s = this->getStats((vMemoryTag)t);
+            std::cout << std::left << std::setw(14) << getName((vMemoryTag)t) << std::right << std::setw(14) << s.liveBytes << std::setw(14) << s.peakBytes
+                      << std::setw(12) << s.liveBlocks << std::setw(14) << s.allocations << std::setw(12) << s.stepAllocations << std::endl;
+        }
+    }
+
+    //worlds alive, when the last one goes away the leak check reports what is left
+    void addWorld()
+    {
+        this->m_worlds.fetch_add(1);
+    }
+
+    void removeWorld()
+    {
+        if(this->m_worlds.fetch_sub(1) == 1 && this->isLeakCheck()) this->checkLeaks();
+    }
+};
+
+//objects of classes deriving from vTracked are allocated with the tag
+template <int TAG>
+class vTracked
+{
+public:
+    static void* operator new(size_t bytes)
+    {
+        return vMemory::global().allocate((vMemoryTag)TAG, bytes);
+    }
+
+    //with a virtual destructor 'bytes' is the size of the derived object
+    static void operator delete(void * p, size_t bytes)
+    {
+        vMemory::global().deallocate((vMemoryTag)TAG, p, bytes);
+    }
+};
+
+//one allocation shared by many containers, ex. the particles of many bodies one after the
+//other in a single array. the containers take their memory in turn (from any thread) and the
+//block goes away when its creator and every container using it have released it
+class vMemoryBlock
+{
+    vMemoryTag m_tag;
+    char * m_data;
+    size_t m_bytes;
+    std::atomic<size_t> m_used{0};
+    std::atomic<int> m_refs{1}; //the creator
+
+    vMemoryBlock(vMemoryTag tag, size_t bytes)
+    {
+        this->m_tag = tag;
+        this->m_bytes = bytes;
+        this->m_data = static_cast<char*>(vMemory::global().allocate(tag, bytes > 0 ? bytes : 1));
+    }
+
+    ~vMemoryBlock()
+    {
+        vMemory::global().deallocate(this->m_tag, this->m_data, this->m_bytes > 0 ? this->m_bytes : 1);
+    }
+
+public:
+    //the block itself is counted with the tag too
+    static vMemoryBlock* create(vMemoryTag tag, size_t bytes)
+    {
+        void * p = vMemory::global().allocate(tag, sizeof(vMemoryBlock));
+        return new (p) vMemoryBlock(tag, bytes);
+    }
+
+    vMemoryBlock(const vMemoryBlock&) = delete;
+
+    vMemoryBlock& operator=(const vMemoryBlock&) = delete;
+
+    //NULL when the block is full
+    void* allocate(size_t bytes, size_t align)
+    {
+        size_t at = this->m_used.load(std::memory_order_relaxed);
+        while(true)
+        {
+            size_t start = (at + align-1) & ~(align-1);
+            if(start + bytes > this->m_bytes) return NULL;
+            if(this->m_used.compare_exchange_weak(at, start + bytes, std::memory_order_relaxed)) return this->m_data + start;
+        }
+    }
+
+    bool contains(const void * p)
+    {
+        return p >= this->m_data && p < this->m_data + this->m_bytes;
+    }
+
+    char* data() { return this->m_data; }
+
+    size_t getUsed() { return this->m_used.load(std::memory_order_relaxed); }
+
+    void retain()
+    {
+        this->m_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release()
+    {
+        if(this->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            vMemoryTag tag = this->m_tag;
+            this->~vMemoryBlock();
+            vMemory::global().deallocate(tag, this, sizeof(vMemoryBlock));
+        }
+    }
+};
+
+//for the containers of the engine, ex. vector<vParticle, vTaggedAllocator<vParticle, MEMORY_PARTICLES>>.
+//built with a vMemoryBlock the container takes its memory from the block while it has room
+//(freeing it is a no-op, the block is released with the allocator)
+template <typename T, int TAG>
+class vTaggedAllocator
+{
+    template <typename U, int OTHER> friend class vTaggedAllocator;
+    vMemoryBlock * m_block = NULL;
+
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <typename U>
+    struct rebind { typedef vTaggedAllocator<U, TAG> other; };
+
+    vTaggedAllocator() {}
+
+    explicit vTaggedAllocator(vMemoryBlock * block)
+    {
+        this->m_block = block;
+        if(block) block->retain();
+    }
+
+    vTaggedAllocator(const vTaggedAllocator &a) : vTaggedAllocator(a.m_block) {}
+
+    template <typename U>
+    vTaggedAllocator(const vTaggedAllocator<U, TAG> &a) : vTaggedAllocator(a.m_block) {}
+
+    vTaggedAllocator& operator=(const vTaggedAllocator &a)
+    {
+        if(a.m_block) a.m_block->retain();
+        if(this->m_block) this->m_block->release();
+        this->m_block = a.m_block;
+        return *this;
+    }
+
+    ~vTaggedAllocator()
+    {
+        if(this->m_block) this->m_block->release();
+    }
+
+    //a copied container gets its own memory
+    vTaggedAllocator select_on_container_copy_construction() const
+    {
+        return vTaggedAllocator();
+    }
+
+    T* allocate(size_t n)
+    {
+        void * p = this->m_block ? this->m_block->allocate(n * sizeof(T), alignof(T)) : NULL;
+        if(p) return static_cast<T*>(p);
+        return static_cast<T*>(vMemory::global().allocate((vMemoryTag)TAG, n * sizeof(T)));
+    }
+
+    void deallocate(T * p, size_t n)
+    {
+        if(this->m_block && this->m_block->contains(p)) return;
+        vMemory::global().deallocate((vMemoryTag)TAG, p, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const vTaggedAllocator<U, TAG> &a) const { return this->m_block == a.m_block; }
+
+    template <typename U>
+    bool operator!=(const vTaggedAllocator<U, TAG> &a) const { return this->m_block != a.m_block; }
+};
+
+//vector<T> whose memory is counted with the tag
+template <typename T, int TAG>
+using vTaggedVector = std::vector<T, vTaggedAllocator<T, TAG>>;
@@ -9,6 +9,11 @@ Real-Time Graphics Programming's Project - 2019/2020
 
 #include <glm/glm.hpp>
 #include <vector>
+#include <utility>
+#include <unordered_map>
+#include <cmath>
+
+#include <physics/memory_v1.h>
 
 using std::vector;
 using std::abs;
@@ -20,6 +25,10 @@ typedef glm::vec3 vec3;
 class OItem 
 {   public:
     virtual bool isMember(vec3 node_pos, float node_side_size) = 0;
+
+    //used by the loose octree: the item is bounded by a sphere
+    virtual vec3 getPosition() = 0;
+    virtual float getBoundingRadius() = 0;
 };
 
 template <class T> class Octree
@@ -48,6 +57,15 @@ public:
         m_depth = depth;
     }
 
+    ~Octree()
+    {
+        delete root;
+    }
+
+    Octree(const Octree&) = delete;
+
+    Octree& operator=(const Octree&) = delete;
+
     void updateTree(vector<T*> items)
     {
         root->clear();
@@ -73,7 +91,7 @@ public:
         root->getLeafs(nodes);
     }    
 
-    class OctreeNode
+    class OctreeNode : public vTracked<MEMORY_OCTREE>
     {
 
     public:
@@ -97,6 +115,11 @@ public:
             m_id = id;
         }
 
+        ~OctreeNode()
+        {
+            for(int i = 0; i < m_subNodes.size(); i++) delete m_subNodes.at(i);
+        }
+
         //we dont take in cosideration the case were the rigidbody are outside the root of the octree
         void update(vector<T*> items, const int &depth)
         {
@@ -180,15 +203,238 @@ public:
             }
         }
 
+        //the subnodes are rebuilt by each update
         void clear()
         {
-            for(int i = 0; i < m_subNodes.size(); i++)
-            {
-                m_subNodes.at(i)->clear();
-            }
+            for(int i = 0; i < m_subNodes.size(); i++) delete m_subNodes.at(i);
             vector<OctreeNode*>().swap(m_subNodes);
             vector<T*>().swap(m_items);
-        }    
+            m_isLeaf = true;
+        }
     };
 };
 
+//Loose Octree: the bounds of every node are enlarged by 'looseness' (2 = twice the side)
+//so that each item is stored once, in the deepest node whose loose bounds contain it.
+//That node is computed from the item alone: the level from its radius and the cell of the
+//level from its position, then looked up in the table of the level (the nodes are kept
+//between updates, a path is created only the first time a cell is used).
+//Pairs are found walking from the root to the children whose loose bounds overlap the item.
+template <class T> class LooseOctree
+{
+public:
+    struct entry
+    {
+        T* item;
+        vec3 pos;
+        float radius;
+        int index; //insertion order, used to report each pair once
+    };
+
+    class LooseNode : public vTracked<MEMORY_OCTREE>
+    {
+    public:
+        vector<entry> m_items;
+        LooseNode * m_subNodes[8];
+        LooseNode * m_parent;
+
+        float m_side_size; //side without the looseness
+        vec3 m_pos;
+        int m_level;
+        unsigned long long m_cell; //key of the cell in its level
+        bool m_used = false; //items in this node or its subnodes
+
+        LooseNode(const vec3 &position, const float &size, LooseNode * parent, int level, unsigned long long cell)
+        {
+            m_side_size = size;
+            m_pos = position;
+            m_parent = parent;
+            m_level = level;
+            m_cell = cell;
+            for(int i = 0; i < 8; i++) m_subNodes[i] = NULL;
+        }
+
+        ~LooseNode()
+        {
+            for(int i = 0; i < 8; i++) delete m_subNodes[i];
+        }
+
+        //child i: bit 0 -> +x, bit 1 -> +y, bit 2 -> +z
+        LooseNode* getSubNode(int i)
+        {
+            if(m_subNodes[i] == NULL)
+            {
+                vec3 newPos = m_pos;
+                newPos.x += ((i & 1) == 1) ? m_side_size*0.25f : -m_side_size*0.25f;
+                newPos.y += ((i & 2) == 2) ? m_side_size*0.25f : -m_side_size*0.25f;
+                newPos.z += ((i & 4) == 4) ? m_side_size*0.25f : -m_side_size*0.25f;
+                unsigned long long x, y, z;
+                unpack(m_cell, x, y, z);
+                m_subNodes[i] = new LooseNode(newPos, m_side_size*0.5f, this, m_level+1, pack(x*2 + (i & 1), y*2 + ((i >> 1) & 1), z*2 + ((i >> 2) & 1)));
+            }
+            return m_subNodes[i];
+        }
+
+        void clear()
+        {
+            if(!m_used) return;
+            m_used = false;
+            m_items.clear();
+            for(int i = 0; i < 8; i++) if(m_subNodes[i]) m_subNodes[i]->clear();
+        }
+    };
+
+    //21 bits per axis
+    static unsigned long long pack(unsigned long long x, unsigned long long y, unsigned long long z)
+    {
+        return x | (y << 21) | (z << 42);
+    }
+
+    static void unpack(unsigned long long key, unsigned long long &x, unsigned long long &y, unsigned long long &z)
+    {
+        x = key & 0x1FFFFF;
+        y = (key >> 21) & 0x1FFFFF;
+        z = (key >> 42) & 0x1FFFFF;
+    }
+
+    typedef std::unordered_map<unsigned long long, LooseNode*, std::hash<unsigned long long>, std::equal_to<unsigned long long>,
+        vTaggedAllocator<std::pair<const unsigned long long, LooseNode*>, MEMORY_OCTREE>> level;
+
+    LooseNode * root;
+    int m_depth;
+    float m_looseness;
+    int m_size = 0;
+    vector<level> m_levels; //cell -> node, for every level
+
+    LooseOctree(vec3 &position, const float &size, int &depth, float looseness = 2.0f)
+    {
+        root = new LooseNode(position, size, NULL, 0, 0);
+        m_depth = depth < 20 ? depth : 20;
+        m_looseness = looseness;
+        m_levels.resize(m_depth+1);
+        m_levels[0][0] = root;
+    }
+
+    ~LooseOctree()
+    {
+        delete root;
+    }
+
+    LooseOctree(const LooseOctree&) = delete;
+
+    LooseOctree& operator=(const LooseOctree&) = delete;
+
+    void updateTree(vector<T*> &items)
+    {
+        root->clear();
+        m_size = 0;
+        for(int i = 0; i < items.size(); i++) insert(items.at(i));
+    }
+
+    //deepest level whose loose bounds fit the radius: the children of a node of side s
+    //take the items with a radius up to s*0.25*(looseness-1)
+    int getLevel(float radius)
+    {
+        float fit = root->m_side_size*0.25f*(m_looseness-1.0f);
+        if(radius <= .0f) return m_depth;
+        if(radius > fit) return 0;
+        int d = (int)std::floor(std::log2(fit / radius)) + 1;
+        return d < m_depth ? d : m_depth;
+    }
+
+    //items outside the root end up in the border cells
+    void insert(T* item)
+    {
+        entry e;
+        e.item = item;
+        e.pos = item->getPosition();
+        e.radius = item->getBoundingRadius();
+        e.index = m_size++;
+
+        int d = getLevel(e.radius);
+        long long cells = 1LL << d;
+        vec3 rel = (e.pos - root->m_pos) / root->m_side_size + vec3(0.5f);
+        long long c[3];
+        for(int k = 0; k < 3; k++)
+        {
+            c[k] = (long long)std::floor(rel[k] * cells);
+            c[k] = c[k] < 0 ? 0 : c[k] >= cells ? cells-1 : c[k];
+        }
+        unsigned long long key = pack(c[0], c[1], c[2]);
+
+        LooseNode * n;
+        typename level::iterator it = m_levels[d].find(key);
+        if(it != m_levels[d].end()) n = it->second;
+        else n = create(d, c);
+        //outside the root the border cell may not contain the item: up to a node that does, or the
+        //root, which is never skipped by the queries
+        while(n->m_parent != NULL && !contains(n, e)) n = n->m_parent;
+        n->m_items.push_back(e);
+
+        //the ancestors of a used node are used: stop at the first one
+        for(LooseNode * p = n; p != NULL && !p->m_used; p = p->m_parent) p->m_used = true;
+    }
+
+    //every pair of items whose bounding spheres overlap, reported once
+    void getPairs(vector<std::pair<T*, T*>> &result)
+    {
+        vector<LooseNode*> nodes, stack;
+        nodes.push_back(root);
+        while(!nodes.empty())
+        {
+            LooseNode * n = nodes.back();
+            nodes.pop_back();
+            if(!n->m_used) continue;
+            for(int i = 0; i < n->m_items.size(); i++) query(n->m_items.at(i), stack, result);
+            for(int i = 0; i < 8; i++) if(n->m_subNodes[i]) nodes.push_back(n->m_subNodes[i]);
+        }
+    }
+
+private:
+    //the path from the root to cell 'c' of level 'd', the bits of the cell choose the children
+    LooseNode* create(int d, long long c[3])
+    {
+        LooseNode * n = root;
+        for(int l = 1; l <= d; l++)
+        {
+            int s = d - l;
+            int i = ((c[0] >> s) & 1) | (((c[1] >> s) & 1) << 1) | (((c[2] >> s) & 1) << 2);
+            bool created = n->m_subNodes[i] == NULL;
+            n = n->getSubNode(i);
+            if(created) m_levels[l][n->m_cell] = n;
+        }
+        return n;
+    }
+
+    bool contains(LooseNode * n, const entry &e)
+    {
+        float h = n->m_side_size*0.5f*m_looseness - e.radius;
+        return abs(e.pos.x - n->m_pos.x) <= h && abs(e.pos.y - n->m_pos.y) <= h && abs(e.pos.z - n->m_pos.z) <= h;
+    }
+
+    void query(const entry &e, vector<LooseNode*> &stack, vector<std::pair<T*, T*>> &result)
+    {
+        stack.clear();
+        stack.push_back(root);
+        while(!stack.empty())
+        {
+            LooseNode * n = stack.back();
+            stack.pop_back();
+            if(!n->m_used) continue;
+
+            //loose bounds vs item bounds
+            float h = n->m_side_size*0.5f*m_looseness + e.radius;
+            if(n != root && abs(e.pos.x - n->m_pos.x) > h || abs(e.pos.y - n->m_pos.y) > h || abs(e.pos.z - n->m_pos.z) > h) continue;
+
+            for(int i = 0; i < n->m_items.size(); i++)
+            {
+                const entry &f = n->m_items.at(i);
+                if(f.index <= e.index) continue;
+                float r = e.radius + f.radius;
+                vec3 d = f.pos - e.pos;
+                if(dot(d, d) <= r*r) result.push_back(std::make_pair(e.item, f.item));
+            }
+            for(int i = 0; i < 8; i++) if(n->m_subNodes[i]) stack.push_back(n->m_subNodes[i]);
+        }
+    }
+};
@@ -0,0 +1,103 @@
+/*
+PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+//Bounded lock-free queue, any number of threads can push and pop at the same time.
+//Each cell carries a sequence number telling whether it is free for the producer of
+//round 'pos' or full for the consumer of round 'pos' (Vyukov's bounded MPMC queue).
+template <typename T>
+class vMpmcQueue
+{
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    cell * m_cells;
+    size_t m_mask;
+
+    //producers and consumers on different cache lines
+    alignas(64) std::atomic<size_t> m_enqueue;
+    alignas(64) std::atomic<size_t> m_dequeue;
+
+public:
+    //the capacity is rounded up to a power of two
+    vMpmcQueue(size_t capacity = 1 << 16)
+    {
+        size_t size = 2;
+        while(size < capacity) size <<= 1;
+        this->m_cells = new cell[size];
+        this->m_mask = size-1;
+        for(size_t i = 0; i < size; i++) this->m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        this->m_enqueue.store(0, std::memory_order_relaxed);
+        this->m_dequeue.store(0, std::memory_order_relaxed);
+    }
+
+    ~vMpmcQueue()
+    {
+        delete[] this->m_cells;
+    }
+
+    vMpmcQueue(const vMpmcQueue&) = delete;
+
+    vMpmcQueue& operator=(const vMpmcQueue&) = delete;
+
+    //false if the queue is full
+    bool push(const T &value)
+    {
+        size_t pos = this->m_enqueue.load(std::memory_order_relaxed);
+        cell * c;
+        while(true)
+        {
+            c = &this->m_cells[pos & this->m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            long long diff = (long long)seq - (long long)pos;
+            if(diff == 0)
+            {
+                if(this->m_enqueue.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+            }
+            else if(diff < 0) return false;
+            else pos = this->m_enqueue.load(std::memory_order_relaxed);
+        }
+        c->data = value;
+        c->sequence.store(pos+1, std::memory_order_release);
+        return true;
+    }
+
+    //false if the queue is empty
+    bool pop(T &value)
+    {
+        size_t pos = this->m_dequeue.load(std::memory_order_relaxed);
+        cell * c;
+        while(true)
+        {
+            c = &this->m_cells[pos & this->m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            long long diff = (long long)seq - (long long)(pos+1);
+            if(diff == 0)
+            {
+                if(this->m_dequeue.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+            }
+            else if(diff < 0) return false;
+            else pos = this->m_dequeue.load(std::memory_order_relaxed);
+        }
+        value = c->data;
+        c->sequence.store(pos + this->m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity()
+    {
+        return this->m_mask+1;
+    }
+};
@@ -9,8 +9,9 @@ Real-Time Graphics Programming's Project - 2019/2020
 #pragma once
 
 #include <physics/verlet/verlet_particle_v1.h>
+#include <physics/memory_v1.h>
 
-class Response
+class Response : public vTracked<MEMORY_RESPONSES>
     {
         //the id is composed by the id of the rb and the id of the patricle
         vector<int> id;
@@ -45,6 +46,21 @@ class Response
             return this->id;
         }
 
+        Movable* getMovable()
+        {
+            return this->mov;
+        }
+
+        vec3 getPosition()
+        {
+            return this->pos;
+        }
+
+        vec3 getLastPosition()
+        {
+            return this->old_pos;
+        }
+
         //this need to be review
         void update(Response * r) //each response share the same Movable
         {
@@ -0,0 +1,293 @@
+/*
+PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//State of the completed steps in a POSIX shared memory ring, for other processes
+//(visualizer, recorder, ...). The writer fills the slots in turn; every slot has a
+//sequence number that is odd while it is being written (seqlock), so a reader knows
+//when what it read has been overwritten. Readers map the memory read only and never
+//block the writer. The layout only uses fixed size types, readers don't need the engine.
+
+//contact between two bodies in the published step
+struct vContactSummary
+{
+    int32_t a, b; //body ids
+    float normal[3];
+    float point[3];
+};
+
+struct vStateHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t maxBodies;
+    uint32_t maxContacts;
+    uint32_t maxStride; //floats per body
+    uint64_t slotBytes;
+    std::atomic<uint64_t> published; //frames written so far, the last one is in slot (published-1) % slots
+};
+
+struct vStateSlot
+{
+    std::atomic<uint32_t> sequence; //odd while writing
+    int32_t frame;
+    int32_t bodies;
+    int32_t contacts;
+    int32_t stride; //floats per body of this step: 16 world matrix, 8 position + quaternion
+    int32_t padding[3];
+    //followed by float transforms[maxBodies*maxStride], int32 ids[maxBodies], vContactSummary contacts[maxContacts]
+};
+
+static_assert(sizeof(vStateHeader) <= 64, "the slots start at byte 64");
+
+class vStateLayout
+{
+public:
+    static const uint32_t MAGIC = 0x56535448; //VSTH
+    static const uint32_t VERSION = 1;
+    static const uint32_t MAX_STRIDE = 16;
+
+    static uint64_t slotBytes(uint32_t maxBodies, uint32_t maxContacts)
+    {
+        uint64_t bytes = sizeof(vStateSlot) + (uint64_t)maxBodies*MAX_STRIDE*sizeof(float) + (uint64_t)maxBodies*sizeof(int32_t) + (uint64_t)maxContacts*sizeof(vContactSummary);
+        return (bytes + 63) & ~(uint64_t)63;
+    }
+
+    static uint64_t bytes(uint32_t slots, uint32_t maxBodies, uint32_t maxContacts)
+    {
+        return 64 + slots * slotBytes(maxBodies, maxContacts);
+    }
+
+    static vStateSlot* slot(const vStateHeader * h, uint32_t i)
+    {
+        return (vStateSlot*)((char*)h + 64 + i * h->slotBytes);
+    }
+
+    static float* transforms(vStateSlot * s)
+    {
+        return (float*)(s+1);
+    }
+
+    static int32_t* ids(const vStateHeader * h, vStateSlot * s)
+    {
+        return (int32_t*)(transforms(s) + h->maxBodies*h->maxStride);
+    }
+
+    static vContactSummary* contacts(const vStateHeader * h, vStateSlot * s)
+    {
+        return (vContactSummary*)(ids(h, s) + h->maxBodies);
+    }
+};
+
+//writer side, owns the shared memory name
+class vStatePublisher
+{
+    std::string m_name;
+    vStateHeader * m_header = NULL;
+    uint64_t m_bytes = 0;
+    vStateSlot * m_writing = NULL;
+
+public:
+    //'slots' completed steps stay readable, a reader slower than that misses frames
+    vStatePublisher(const std::string &name, int maxBodies, int maxContacts, int slots = 4)
+    {
+        this->m_name = name;
+        this->m_bytes = vStateLayout::bytes(slots, maxBodies, maxContacts);
+
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+        if(fd < 0 || ftruncate(fd, this->m_bytes) != 0)
+        {
+            std::cout << "verlet state publisher -> can't create " << name << std::endl;
+            if(fd >= 0) close(fd);
+            return;
+        }
+        void * p = mmap(NULL, this->m_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if(p == MAP_FAILED)
+        {
+            std::cout << "verlet state publisher -> can't map " << name << std::endl;
+            return;
+        }
+
+        std::memset(p, 0, this->m_bytes);
+        this->m_header = static_cast<vStateHeader*>(p);
+        this->m_header->version = vStateLayout::VERSION;
+        this->m_header->slots = slots;
+        this->m_header->maxBodies = maxBodies;
+        this->m_header->maxContacts = maxContacts;
+        this->m_header->maxStride = vStateLayout::MAX_STRIDE;
+        this->m_header->slotBytes = vStateLayout::slotBytes(maxBodies, maxContacts);
+        this->m_header->published.store(0, std::memory_order_relaxed);
+        //readers check the magic last
+        std::atomic_thread_fence(std::memory_order_release);
+        this->m_header->magic = vStateLayout::MAGIC;
+    }
+
+    ~vStatePublisher()
+    {
+        if(this->m_header == NULL) return;
+        munmap(this->m_header, this->m_bytes);
+        shm_unlink(this->m_name.c_str()); //mapped readers keep their memory
+    }
+
+    vStatePublisher(const vStatePublisher&) = delete;
+
+    vStatePublisher& operator=(const vStatePublisher&) = delete;
+
+    bool isOpen() { return this->m_header != NULL; }
+
+    int getMaxBodies() { return this->m_header->maxBodies; }
+
+    int getMaxContacts() { return this->m_header->maxContacts; }
+
+    //start writing the next slot, fill the arrays then call commit
+    void begin(float * &transforms, int32_t * &ids, vContactSummary * &contacts)
+    {
+        uint64_t n = this->m_header->published.load(std::memory_order_relaxed);
+        this->m_writing = vStateLayout::slot(this->m_header, n % this->m_header->slots);
+        this->m_writing->sequence.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        transforms = vStateLayout::transforms(this->m_writing);
+        ids = vStateLayout::ids(this->m_header, this->m_writing);
+        contacts = vStateLayout::contacts(this->m_header, this->m_writing);
+    }
+
+    void commit(int frame, int bodies, int stride, int contacts)
+    {
+        this->m_writing->frame = frame;
+        this->m_writing->bodies = bodies;
+        this->m_writing->stride = stride;
+        this->m_writing->contacts = contacts;
+        this->m_writing->sequence.fetch_add(1, std::memory_order_release);
+        this->m_header->published.fetch_add(1, std::memory_order_release);
+        this->m_writing = NULL;
+    }
+};
+
+//reader side: maps the ring read only, the data is read in place
+class vStateReader
+{
+    vStateHeader * m_header = NULL;
+    uint64_t m_bytes = 0;
+
+public:
+    //a published step, the pointers point in the shared memory
+    struct snapshot
+    {
+        uint64_t index;     //number of the publication, to spot missed frames
+        int frame;          //vPhysics::getFrame
+        int bodies, stride, contacts;
+        const float * transforms;
+        const int32_t * ids;
+        const vContactSummary * contactList;
+        uint32_t sequence;
+        const vStateSlot * slot;
+    };
+
+    vStateReader() {}
+
+    ~vStateReader()
+    {
+        close();
+    }
+
+    vStateReader(const vStateReader&) = delete;
+
+    vStateReader& operator=(const vStateReader&) = delete;
+
+    //false if the publisher is not there (yet)
+    bool open(const std::string &name)
+    {
+        close();
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if(fd < 0) return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size < 64) { ::close(fd); return false; }
+        void * p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(p == MAP_FAILED) return false;
+
+        vStateHeader * h = static_cast<vStateHeader*>(p);
+        if(h->magic != vStateLayout::MAGIC || h->version != vStateLayout::VERSION ||
+           (uint64_t)st.st_size < vStateLayout::bytes(h->slots, h->maxBodies, h->maxContacts))
+        {
+            munmap(p, st.st_size);
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        this->m_header = h;
+        this->m_bytes = st.st_size;
+        return true;
+    }
+
+    void close()
+    {
+        if(this->m_header) munmap(this->m_header, this->m_bytes);
+        this->m_header = NULL;
+    }
+
+    bool isOpen() { return this->m_header != NULL; }
+
+    uint64_t getPublished()
+    {
+        return this->m_header ? this->m_header->published.load(std::memory_order_acquire) : 0;
+    }
+
+    //the last published step. false if nothing has been published or the slot is being rewritten.
+    //the data can be overwritten while it is read: check it with validate afterwards
+    bool acquire(snapshot &f)
+    {
+        uint64_t n = this->getPublished();
+        return n > 0 && this->acquire(f, n-1);
+    }
+
+    //publication number 'index', if it is still in the ring
+    bool acquire(snapshot &f, uint64_t index)
+    {
+        if(this->m_header == NULL) return false;
+        uint64_t n = this->getPublished();
+        if(index >= n || index + this->m_header->slots < n) return false;
+
+        vStateSlot * s = vStateLayout::slot(this->m_header, index % this->m_header->slots);
+        f.sequence = s->sequence.load(std::memory_order_acquire);
+        //odd: being written. a slot is written for the k-th time for publication k*slots + i
+        if(f.sequence & 1 || f.sequence != 2*(index / this->m_header->slots + 1)) return false;
+
+        f.index = index;
+        f.slot = s;
+        f.frame = s->frame;
+        f.bodies = s->bodies;
+        f.stride = s->stride;
+        f.contacts = s->contacts;
+        f.transforms = vStateLayout::transforms(s);
+        f.ids = vStateLayout::ids(this->m_header, s);
+        f.contactList = vStateLayout::contacts(this->m_header, s);
+        return true;
+    }
+
+    //true if the writer didn't touch the frame since it was acquired
+    bool validate(const snapshot &f)
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return f.slot->sequence.load(std::memory_order_relaxed) == f.sequence;
+    }
+};
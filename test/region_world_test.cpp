@@ -0,0 +1,143 @@
+/*
+PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+//Pairs of spheres collide head-on across the borders of the regions of a vRegionWorld (along x,
+//along y and diagonally over an edge), with gravity and drag off. Returns 0 if every pair bounces
+//back as in a single world and keeps its momentum: no sphere passes through the other one.
+//
+//build from the directory that contains the physics folder:
+//  g++ -std=c++17 -I. physics/test/region_world_test.cpp -o region_world_test -lpthread
+
+#include <GL/gl.h>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include <unistd.h>
+
+//the physics headers use std::sqrtf and std::powf, libstdc++ has them only in the global namespace
+namespace std { using ::sqrtf; using ::powf; }
+
+#include <physics/verlet/verlet_region_world_v1.h>
+
+const int STEPS = 200;
+const float DT = 0.016f;
+const float REGION_SIZE = 4.0f; //borders at x, y, z = 2 + 4k
+const float TOLERANCE = 0.05f; //from the single world, the ghosts are a step behind
+const float MOMENTUM_TOLERANCE = 1e-3f; //relative
+
+GLfloat color[3] = { 1.0f, 1.0f, 1.0f };
+
+//body 2*i comes from the region before the border, 2*i+1 from the one after it
+const int PAIRS = 3;
+const vec3 POSITION[2*PAIRS] = { vec3(1.4f, 0.0f, 0.0f), vec3(2.6f, 0.0f, 0.0f),
+                                 vec3(-8.0f, 1.4f, 0.0f), vec3(-8.0f, 2.6f, 0.0f),
+                                 vec3(9.5f, 1.5f, 0.0f), vec3(10.5f, 2.5f, 0.0f) };
+const vec3 VELOCITY[2*PAIRS] = { vec3(0.02f, 0.0f, 0.0f), vec3(-0.01f, 0.0f, 0.0f),
+                                 vec3(0.0f, 0.015f, 0.0f), vec3(0.0f, -0.015f, 0.0f),
+                                 vec3(0.01f, 0.01f, 0.0f), vec3(-0.01f, -0.01f, 0.0f) };
+const float MASS[2*PAIRS] = { 0.5f, 1.0f, 1.0f, 1.0f, 0.5f, 0.5f };
+
+vPhysics::spherePrefab sphere(int i)
+{
+    vPhysics::spherePrefab s;
+    s.color = color;
+    s.radius = 0.3f;
+    s.gravity = false;
+    s.drag = 0.0f;
+    s.pos = POSITION[i];
+    s.mass = MASS[i];
+    return s;
+}
+
+//moves the body by v every step
+void kick(vRigidBody * rb, vec3 v)
+{
+    vParticle &p = rb->getParticles()->at(0);
+    p.setPosition(p.getPosition(), p.getPosition() - v);
+}
+
+int main()
+{
+    //the reference
+    vPhysics single;
+    single.setWorld(20.0f);
+    vector<vRigidBody*> reference;
+    for(int i = 0; i < 2*PAIRS; i++)
+    {
+        reference.push_back(single.addSphere(sphere(i)));
+        kick(reference[i], VELOCITY[i]);
+    }
+    for(int i = 0; i < STEPS; i++) single.step(DT);
+
+    char dir[] = "/tmp/region_world_test_XXXXXX";
+    if(!mkdtemp(dir))
+    {
+        std::cout << "region world test -> can't create the store" << std::endl;
+        return 1;
+    }
+
+    int failed = 0;
+    {
+        //no anchors: every region stays in memory
+        vRegionWorld world(REGION_SIZE, 10.0f, dir);
+        world.ghostWidth = 1.0f;
+        vector<vRegionWorld::regionHandle> handles;
+        for(int i = 0; i < 2*PAIRS; i++)
+        {
+            handles.push_back(world.addSphere(sphere(i)));
+            kick(world.getBody(handles[i]), VELOCITY[i]);
+        }
+        for(int i = 0; i < STEPS; i++) world.step(DT);
+
+        for(int k = 0; k < PAIRS; k++)
+        {
+            vec3 pos[2], vel[2];
+            for(int j = 0; j < 2; j++)
+            {
+                if(!world.getPosition(handles[2*k+j], pos[j]))
+                {
+                    std::cout << "region world test -> body " << 2*k+j << " is lost" << std::endl;
+                    return 1;
+                }
+                vel[j] = world.getBody(handles[2*k+j])->getVelocity();
+            }
+
+            vec3 axis = glm::normalize(VELOCITY[2*k]);
+            vec3 before = MASS[2*k]*VELOCITY[2*k] + MASS[2*k+1]*VELOCITY[2*k+1];
+            vec3 after = MASS[2*k]*vel[0] + MASS[2*k+1]*vel[1];
+            float momentum = glm::length(after - before) / (MASS[2*k]*glm::length(VELOCITY[2*k]) + MASS[2*k+1]*glm::length(VELOCITY[2*k+1]));
+            float error = std::max(glm::length(pos[0] - reference[2*k]->getPosition()), glm::length(pos[1] - reference[2*k+1]->getPosition()));
+            std::cout << "region world test -> pair " << k << " velocities " << glm::dot(vel[0], axis) << " " << glm::dot(vel[1], axis)
+                      << ", momentum error " << momentum << ", from the single world " << error << std::endl;
+
+            if(glm::dot(pos[1] - pos[0], axis) <= 0 || glm::dot(vel[1] - vel[0], axis) <= 0)
+            {
+                std::cout << "region world test -> pair " << k << " didn't bounce" << std::endl;
+                failed++;
+            }
+            if(momentum > MOMENTUM_TOLERANCE)
+            {
+                std::cout << "region world test -> pair " << k << " lost its momentum" << std::endl;
+                failed++;
+            }
+            if(error > TOLERANCE)
+            {
+                std::cout << "region world test -> pair " << k << " is " << error << " away from the single world" << std::endl;
+                failed++;
+            }
+        }
+    }
+    rmdir(dir);
+
+    std::cout << "region world test -> " << PAIRS << " pairs" << (failed ? " FAILED" : " ok") << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+/*
+PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+//Boxes resting on a static floor, two of them stacked (the pairs take the warm started path of the contact
+//cache) are rolled back again and again with the determinism check on. Returns 0 if every
+//re-simulated frame is bit identical to the first run and reports the same contact events.
+//
+//build from the directory that contains the physics folder:
+//  g++ -std=c++17 -I. physics/test/rollback_test.cpp -o rollback_test -lpthread
+
+#include <GL/gl.h>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+//the physics headers use std::sqrtf and std::powf, libstdc++ has them only in the global namespace
+namespace std { using ::sqrtf; using ::powf; }
+
+#include <physics/verlet/verlet_physics_v1.h>
+
+const float DT = 0.016f;
+const int WINDOW = 30; //frames rolled back
+const int ROUNDS = 16;
+
+GLfloat color[3] = { 1.0f, 1.0f, 1.0f };
+
+//events of a step as comparable numbers
+void record(vPhysics &world, vector<long long> &out)
+{
+    out.clear();
+    vector<CollisionSolver::contactEvent> * events = world.getContactEvents();
+    for(int i = 0; i < events->size(); i++)
+        out.push_back(((long long)events->at(i).type << 40) | ((long long)events->at(i).a << 20) | events->at(i).b);
+}
+
+int main()
+{
+    vPhysics world;
+    world.setWorld(10.0f);
+
+    vPhysics::boxPrefab floor;
+    floor.color = color;
+    floor.pos = vec3(0.0f, -5.0f, 0.0f);
+    floor.scale = vec3(8.0f, 0.5f, 8.0f);
+    floor.staticBody = true;
+    world.addBox(floor);
+    //a row of four boxes, the first two with another box on top
+    for(int i = 0; i < 6; i++)
+    {
+        vPhysics::boxPrefab b;
+        b.color = color;
+        b.pos = i < 4 ? vec3(-3.0f + 2.0f*i, -4.0f, 0.0f) : vec3(-3.0f + 2.0f*(i-4), -2.95f, 0.0f);
+        b.scale = vec3(0.5f);
+        world.addBox(b);
+    }
+
+    if(!world.enableRollback(2*WINDOW, true))
+    {
+        std::cout << "rollback test -> can't enable the rollback" << std::endl;
+        return 1;
+    }
+
+    //the stack settles
+    for(int i = 0; i < 60; i++) world.step(DT);
+
+    int failed = 0;
+    for(int r = 0; r < ROUNDS; r++)
+    {
+        vector<vector<long long>> first(WINDOW);
+        int from = world.getFrame();
+        for(int i = 0; i < WINDOW; i++)
+        {
+            world.step(DT);
+            record(world, first[i]);
+        }
+        vector<vec3> end;
+        for(int i = 0; i < world.getRigidBodies()->size(); i++) end.push_back(world.getRigidBodies()->at(i)->getPosition());
+
+        if(!world.rollback(from))
+        {
+            std::cout << "rollback test -> can't roll back to frame " << from << std::endl;
+            return 1;
+        }
+        for(int i = 0; i < WINDOW; i++)
+        {
+            world.step(DT);
+            vector<long long> again;
+            record(world, again);
+            if(again != first[i])
+            {
+                std::cout << "rollback test -> frame " << world.getFrame() << " reports other contact events" << std::endl;
+                failed++;
+            }
+        }
+        for(int i = 0; i < end.size(); i++)
+            if(world.getRigidBodies()->at(i)->getPosition() != end[i])
+            {
+                std::cout << "rollback test -> body " << i << " ends somewhere else after the rollback to " << from << std::endl;
+                failed++;
+            }
+    }
+
+    int mismatches = world.getRollback()->getMismatches();
+    if(mismatches > 0) failed++;
+    std::cout << "rollback test -> " << ROUNDS << " rollbacks of " << WINDOW << " frames, " << mismatches << " mismatching frames"
+              << (failed ? " FAILED" : " ok") << std::endl;
+    return failed ? 1 : 0;
+}
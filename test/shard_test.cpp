@@ -0,0 +1,269 @@
+/*
+PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+//Runs two scenes split in two shards (two processes over a socket pair).
+//In the first one the bodies cross the border between the slabs but never touch across it: the
+//position of every body must match the same scene run in one world.
+//In the second one pairs of bodies collide head-on across the border, with gravity and drag off:
+//the pair must bounce back or stop (no body passes through the other) and keep its momentum, the
+//contact is resolved once with the real mass of both bodies.
+//Returns 0 if both pass.
+//
+//build from the directory that contains the physics folder:
+//  g++ -std=c++17 -I. physics/test/shard_test.cpp -o shard_test -lpthread -lrt
+
+#include <GL/gl.h>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+#include <sys/wait.h>
+
+//the physics headers use std::sqrtf and std::powf, libstdc++ has them only in the global namespace
+namespace std { using ::sqrtf; using ::powf; }
+
+#include <physics/verlet/verlet_shard_v1.h>
+
+const int STEPS = 200;
+const float DT = 0.016f;
+const float WORLD_SIZE = 5.0f;
+const float TOLERANCE = 1e-4f;
+const float MOMENTUM_TOLERANCE = 1e-3f; //relative
+
+GLfloat color[3] = { 1.0f, 1.0f, 1.0f };
+
+//a row of spheres and a row of boxes spread over both slabs
+template <class W> void setup(W &w)
+{
+    for(int i = 0; i < 10; i++)
+    {
+        vPhysics::spherePrefab s;
+        s.color = color;
+        s.radius = 0.2f;
+        s.pos = vec3(-4.0f + 0.9f*i, -1.0f + 0.5f*(i%3), (i%2)*1.0f);
+        w.addSphere(s);
+    }
+    for(int i = 0; i < 4; i++)
+    {
+        vPhysics::boxPrefab b;
+        b.color = color;
+        b.pos = vec3(-3.6f + 2.4f*i, 2.0f, -1.5f);
+        b.scale = vec3(0.5f);
+        w.addBox(b);
+    }
+}
+
+//pairs heading to each other across the border at x = 0: two spheres of different mass, two boxes.
+//body 2*i is on the left, 2*i+1 on the right
+const int PAIRS = 2;
+const vec3 BORDER_VELOCITY[2*PAIRS] = { vec3(0.02f, 0.0f, 0.0f), vec3(-0.01f, 0.0f, 0.0f), vec3(0.015f, 0.0f, 0.0f), vec3(-0.015f, 0.0f, 0.0f) };
+
+template <class W> void setupBorder(W &w)
+{
+    vPhysics::spherePrefab s;
+    s.color = color;
+    s.radius = 0.3f;
+    s.gravity = false;
+    s.drag = 0.0f;
+    s.pos = vec3(-0.6f, 0.0f, 0.0f);
+    s.mass = 0.5f;
+    w.addSphere(s);
+    s.pos = vec3(0.6f, 0.0f, 0.0f);
+    s.mass = 1.0f;
+    w.addSphere(s);
+
+    vPhysics::boxPrefab b;
+    b.color = color;
+    b.scale = vec3(0.3f);
+    b.gravity = false;
+    b.drag = 0.0f;
+    b.pos = vec3(-0.7f, 0.0f, 2.0f);
+    w.addBox(b);
+    b.pos = vec3(0.7f, 0.0f, 2.0f);
+    w.addBox(b);
+}
+
+//moves the body by v every step
+void kick(vRigidBody * rb, vec3 v = vec3(0.03f, 0.0f, 0.0f))
+{
+    if(rb == NULL) return;
+    for(int i = 0; i < rb->getParticles()->size(); i++)
+    {
+        vParticle &p = rb->getParticles()->at(i);
+        p.setPosition(p.getPosition(), p.getPosition() - v);
+    }
+}
+
+//the reference: one world with the same add calls, so body i has global id i
+struct single
+{
+    vPhysics world;
+    vector<vRigidBody*> bodies;
+
+    single() { world.setWorld(WORLD_SIZE); }
+
+    long long addSphere(vPhysics::spherePrefab s) { bodies.push_back(world.addSphere(s)); return bodies.size()-1; }
+    long long addBox(vPhysics::boxPrefab b) { bodies.push_back(world.addBox(b)); return bodies.size()-1; }
+};
+
+struct result
+{
+    long long id;
+    vec3 pos, vel;
+};
+
+//runs a scene in this shard, the first shard gets back the owned bodies of both (false if the
+//second shard didn't send them)
+bool run(int index, vTransport * transport, int scene, int bodies, vector<result> &owned, size_t &first)
+{
+    vShard * shard = new vShard(index, 2, WORLD_SIZE, 1.0f, transport);
+    if(scene == 0) setup(*shard);
+    else setupBorder(*shard);
+    for(long long id = 0; id < bodies; id++)
+        if(scene == 0) kick(shard->getBody(id));
+        else kick(shard->getBody(id), BORDER_VELOCITY[id]);
+    for(int i = 0; i < STEPS; i++) shard->step(DT);
+
+    vector<long long> ids;
+    shard->getOwned(ids);
+    owned.resize(ids.size());
+    for(int i = 0; i < ids.size(); i++)
+    {
+        owned[i].id = ids[i];
+        owned[i].pos = shard->getBody(ids[i])->getPosition();
+        owned[i].vel = shard->getBody(ids[i])->getVelocity();
+    }
+    delete shard;
+
+    //the second shard sends its bodies to the first one
+    vector<char> msg(owned.size()*sizeof(result));
+    if(!owned.empty()) std::memcpy(msg.data(), owned.data(), msg.size());
+    if(index == 1) return transport->send(0, msg);
+
+    if(!transport->receive(1, msg)) return false;
+    first = owned.size();
+    owned.resize(first + msg.size()/sizeof(result));
+    if(!msg.empty()) std::memcpy(&owned[first], msg.data(), msg.size());
+    return true;
+}
+
+//every body owned by exactly one shard
+int checkOwned(const vector<result> &owned, int bodies)
+{
+    int failed = 0;
+    vector<int> seen(bodies, 0);
+    for(int i = 0; i < owned.size(); i++)
+    {
+        long long id = owned[i].id;
+        if(id < 0 || id >= bodies || seen[id]++ > 0)
+        {
+            std::cout << "shard test -> body " << id << " owned twice or unknown" << std::endl;
+            failed++;
+        }
+    }
+    for(int i = 0; i < seen.size(); i++)
+        if(seen[i] == 0)
+        {
+            std::cout << "shard test -> body " << i << " is lost" << std::endl;
+            failed++;
+        }
+    return failed;
+}
+
+int main()
+{
+    single s;
+    setup(s);
+    for(int i = 0; i < s.bodies.size(); i++) kick(s.bodies[i]);
+    for(int i = 0; i < STEPS; i++) s.world.step(DT);
+
+    //only for the masses
+    single border;
+    setupBorder(border);
+
+    int fd[2];
+    if(!vSocketTransport::socketPair(fd[0], fd[1]))
+    {
+        std::cout << "shard test -> socket pair failed" << std::endl;
+        return 1;
+    }
+
+    pid_t pid = fork();
+    if(pid < 0) return 1;
+    int index = pid == 0 ? 1 : 0;
+
+    vSocketTransport * transport = new vSocketTransport();
+    transport->connect(1-index, fd[index]);
+    close(fd[1-index]);
+
+    vector<result> owned[2];
+    size_t first = 0;
+    bool ok = run(index, transport, 0, s.bodies.size(), owned[0], first);
+    ok = ok && run(index, transport, 1, border.bodies.size(), owned[1], first);
+    delete transport;
+    if(index == 1) _exit(ok ? 0 : 1);
+
+    int status = 1;
+    waitpid(pid, &status, 0);
+    if(!ok || status != 0)
+    {
+        std::cout << "shard test -> the second shard failed" << std::endl;
+        return 1;
+    }
+
+    //1 - where the single world has them
+    int failed = checkOwned(owned[0], s.bodies.size());
+    float maxError = 0.0f;
+    for(int i = 0; i < owned[0].size(); i++)
+    {
+        long long id = owned[0][i].id;
+        if(id < 0 || id >= s.bodies.size()) continue;
+        float error = glm::length(owned[0][i].pos - s.bodies[id]->getPosition());
+        maxError = std::max(maxError, error);
+        if(error > TOLERANCE)
+        {
+            std::cout << "shard test -> body " << id << " is " << error << " away from the single world" << std::endl;
+            failed++;
+        }
+    }
+    std::cout << "shard test -> " << owned[0].size() << " bodies, max error " << maxError << std::endl;
+
+    //2 - bounced back with the momentum they had
+    int borderFailed = checkOwned(owned[1], border.bodies.size());
+    if(borderFailed == 0)
+    {
+        vector<result> byId(border.bodies.size());
+        for(int i = 0; i < owned[1].size(); i++) byId[owned[1][i].id] = owned[1][i];
+        for(int k = 0; k < PAIRS; k++)
+        {
+            const result &l = byId[2*k], &r = byId[2*k+1];
+            float ml = border.bodies[2*k]->getMass(), mr = border.bodies[2*k+1]->getMass();
+            vec3 before = ml*BORDER_VELOCITY[2*k] + mr*BORDER_VELOCITY[2*k+1];
+            vec3 after = ml*l.vel + mr*r.vel;
+            float error = glm::length(after - before) / (ml*glm::length(BORDER_VELOCITY[2*k]) + mr*glm::length(BORDER_VELOCITY[2*k+1]));
+            std::cout << "shard test -> pair " << k << " at " << l.pos.x << " " << r.pos.x << ", velocities " << l.vel.x << " " << r.vel.x << ", momentum error " << error << std::endl;
+            //the boxes of the second pair stop: they may not be approaching anymore
+            if(l.pos.x >= r.pos.x || l.vel.x > r.vel.x + 1e-5f)
+            {
+                std::cout << "shard test -> pair " << k << " didn't bounce" << std::endl;
+                borderFailed++;
+            }
+            if(error > MOMENTUM_TOLERANCE)
+            {
+                std::cout << "shard test -> pair " << k << " lost its momentum" << std::endl;
+                borderFailed++;
+            }
+        }
+    }
+    failed += borderFailed;
+
+    std::cout << "shard test -> first shard " << first << (failed ? " FAILED" : " ok") << std::endl;
+    return failed ? 1 : 0;
+}
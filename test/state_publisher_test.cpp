@@ -0,0 +1,170 @@
+/*
+PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+//A producer process steps a vPhysics with enablePublishing, this process reads the ring with
+//vStateReader while it is written. Returns 0 if the frames only go forward and the snapshots that
+//pass validate are whole steps: every body there, every transform well formed.
+//
+//build from the directory that contains the physics folder:
+//  g++ -std=c++17 -I. physics/test/state_publisher_test.cpp -o state_publisher_test -lpthread -lrt
+
+#include <GL/gl.h>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+#include <sys/wait.h>
+
+//the physics headers use std::sqrtf and std::powf, libstdc++ has them only in the global namespace
+namespace std { using ::sqrtf; using ::powf; }
+
+#include <physics/verlet/verlet_physics_v1.h>
+
+const char * NAME = "/vphysics_state_test";
+const int STEPS = 500;
+const int BOXES = 20;
+
+GLfloat color[3] = { 1.0f, 1.0f, 1.0f };
+
+//boxes falling on a static floor, so that there are contacts to publish.
+//'done' is closed by the reader once it is finished: the ring stays there until then
+int produce(int done)
+{
+    vPhysics world;
+    world.setWorld(10.0f);
+
+    vPhysics::boxPrefab floor;
+    floor.color = color;
+    floor.pos = vec3(0.0f, -5.0f, 0.0f);
+    floor.scale = vec3(8.0f, 0.5f, 8.0f);
+    floor.staticBody = true;
+    world.addBox(floor);
+    for(int i = 0; i < BOXES; i++)
+    {
+        vPhysics::boxPrefab b;
+        b.color = color;
+        b.pos = vec3(-4.0f + 2.0f*(i%5), -3.0f + 1.2f*(i/5), 0.0f);
+        b.scale = vec3(0.5f);
+        world.addBox(b);
+    }
+
+    if(!world.enablePublishing(NAME, BOXES+1, 256, 4)) return 1;
+    for(int i = 0; i < STEPS; i++)
+    {
+        world.step(0.016f);
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    char c;
+    while(read(done, &c, 1) > 0) {}
+    return 0;
+}
+
+int main()
+{
+    shm_unlink(NAME); //left by a crashed run
+
+    int done[2];
+    if(pipe(done) != 0) return 1;
+    pid_t pid = fork();
+    if(pid < 0) return 1;
+    if(pid == 0)
+    {
+        close(done[1]);
+        int r = produce(done[0]);
+        std::cout.flush();
+        _exit(r);
+    }
+    close(done[0]);
+
+    vStateReader reader;
+    while(!reader.open(NAME)) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    int failed = 0, valid = 0, torn = 0;
+    int lastFrame = -1;
+    uint64_t lastIndex = 0, missed = 0;
+    bool first = true;
+    int contacts = 0;
+    while(true)
+    {
+        uint64_t published = reader.getPublished();
+        vStateReader::snapshot f;
+        if(!reader.acquire(f))
+        {
+            if(published >= STEPS) break;
+            std::this_thread::yield();
+            continue;
+        }
+        if(!first && f.index == lastIndex)
+        {
+            if(published >= STEPS) break;
+            std::this_thread::yield();
+            continue;
+        }
+
+        //read the step as a consumer would, then check that it was not overwritten meanwhile
+        vector<float> transforms(f.transforms, f.transforms + f.bodies*f.stride);
+        vector<int32_t> ids(f.ids, f.ids + f.bodies);
+        int frame = f.frame, bodies = f.bodies, stride = f.stride, count = f.contacts;
+        if(!reader.validate(f))
+        {
+            torn++;
+            continue;
+        }
+        valid++;
+
+        if(!first && (f.index <= lastIndex || frame <= lastFrame))
+        {
+            std::cout << "state publisher test -> publication " << f.index << " frame " << frame << " after " << lastIndex << " frame " << lastFrame << std::endl;
+            failed++;
+        }
+        if(!first) missed += f.index - lastIndex - 1;
+        first = false;
+        lastIndex = f.index;
+        lastFrame = frame;
+        contacts = std::max(contacts, count);
+
+        if(bodies != BOXES+1 || stride != 8)
+        {
+            std::cout << "state publisher test -> frame " << frame << " has " << bodies << " bodies, stride " << stride << std::endl;
+            failed++;
+            continue;
+        }
+        for(int i = 0; i < bodies; i++)
+        {
+            const float * t = &transforms[i*stride];
+            float q = t[4]*t[4] + t[5]*t[5] + t[6]*t[6] + t[7]*t[7];
+            if(ids[i] < 0 || t[3] != 1.0f || std::abs(q - 1.0f) > 1e-3f)
+            {
+                std::cout << "state publisher test -> frame " << frame << " body " << i << " is not well formed" << std::endl;
+                failed++;
+                break;
+            }
+        }
+    }
+
+    close(done[1]);
+    int status = 1;
+    waitpid(pid, &status, 0);
+    if(status != 0)
+    {
+        std::cout << "state publisher test -> the producer failed" << std::endl;
+        failed++;
+    }
+    if(valid == 0 || lastFrame <= 0)
+    {
+        std::cout << "state publisher test -> nothing was read" << std::endl;
+        failed++;
+    }
+
+    std::cout << "state publisher test -> " << valid << " frames read, " << torn << " torn, " << missed << " missed, last frame " << lastFrame
+              << ", max contacts " << contacts << (failed ? " FAILED" : " ok") << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,144 @@
+/*
+PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using std::vector;
+
+//Small pool of persistent worker threads used to split loops over bodies
+//(creation, broad phase build, ...) across the cores.
+//parallelFor called from inside a worker runs inline, so nested loops can't deadlock.
+class vThreadPool
+{
+    vector<std::thread> m_workers;
+
+    std::mutex m_call; //one parallelFor at a time
+    std::mutex m_mutex;
+    std::condition_variable m_wake, m_done;
+
+    const std::function<void(int, int)> * m_fn = NULL;
+    int m_count = 0, m_chunk = 0, m_next = 0, m_pending = 0;
+    unsigned m_generation = 0;
+    bool m_stop = false;
+
+public:
+    vThreadPool(int threads = -1)
+    {
+        if(threads < 0) threads = (int)std::thread::hardware_concurrency() - 1; //the caller works too
+        for(int i = 0; i < threads; i++)
+            this->m_workers.push_back(std::thread([this]() { this->work(); }));
+    }
+
+    ~vThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+            this->m_stop = true;
+        }
+        this->m_wake.notify_all();
+        for(int i = 0; i < this->m_workers.size(); i++) this->m_workers[i].join();
+    }
+
+    static vThreadPool& global()
+    {
+        static vThreadPool pool;
+        return pool;
+    }
+
+    int size()
+    {
+        return (int)this->m_workers.size()+1;
+    }
+
+    //call fn(begin, end) on sub ranges of [0, count), at least 'grain' items each
+    void parallelFor(int count, const std::function<void(int, int)> &fn, int grain = 64)
+    {
+        if(count <= 0) return;
+        if(grain < 1) grain = 1;
+        if(this->m_workers.empty() || count <= grain || inWorker())
+        {
+            fn(0, count);
+            return;
+        }
+
+        std::lock_guard<std::mutex> call(this->m_call);
+
+        int chunks = (count + grain - 1) / grain;
+        if(chunks > this->size()*4) chunks = this->size()*4;
+
+        {
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+            this->m_fn = &fn;
+            this->m_count = count;
+            this->m_chunk = (count + chunks - 1) / chunks;
+            this->m_next = 0;
+            this->m_pending = (count + this->m_chunk - 1) / this->m_chunk;
+            this->m_generation++;
+        }
+        this->m_wake.notify_all();
+
+        inWorker() = true;
+        runChunks();
+        inWorker() = false;
+
+        std::unique_lock<std::mutex> lock(this->m_mutex);
+        this->m_done.wait(lock, [this]() { return this->m_pending == 0; });
+        this->m_fn = NULL;
+    }
+
+private:
+    static bool& inWorker()
+    {
+        thread_local bool worker = false;
+        return worker;
+    }
+
+    void work()
+    {
+        inWorker() = true;
+        unsigned seen = 0;
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(this->m_mutex);
+                this->m_wake.wait(lock, [&]() { return this->m_stop || this->m_generation != seen; });
+                if(this->m_stop) return;
+                seen = this->m_generation;
+            }
+            runChunks();
+        }
+    }
+
+    void runChunks()
+    {
+        while(true)
+        {
+            int begin, end;
+            const std::function<void(int, int)> * fn;
+            {
+                std::lock_guard<std::mutex> lock(this->m_mutex);
+                if(this->m_fn == NULL || this->m_next >= this->m_count) return;
+                begin = this->m_next;
+                end = begin + this->m_chunk < this->m_count ? begin + this->m_chunk : this->m_count;
+                this->m_next = end;
+                fn = this->m_fn;
+            }
+
+            (*fn)(begin, end);
+
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+            if(--this->m_pending == 0) this->m_done.notify_all();
+        }
+    }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <cmath>
 
 
 typedef glm::vec3 vec3;
@@ -38,3 +39,35 @@ static vec3 middleVector(vec3 v, vec3 w)
 
 
 
+
+//number of leading zero bits of a 32 bit word
+static int countLeadingZeros(unsigned int x)
+{
+    if(x == 0) return 32;
+    int n = 0;
+    if((x & 0xFFFF0000u) == 0) { n += 16; x <<= 16; }
+    if((x & 0xFF000000u) == 0) { n += 8; x <<= 8; }
+    if((x & 0xF0000000u) == 0) { n += 4; x <<= 4; }
+    if((x & 0xC0000000u) == 0) { n += 2; x <<= 2; }
+    if((x & 0x80000000u) == 0) { n += 1; }
+    return n;
+}
+
+//insert two 0 bits after each of the 10 low bits of v
+static unsigned int expandBits(unsigned int v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+//30 bit Morton code (Z-order curve) of a point with coordinates in [0, 1]
+static unsigned int morton3D(vec3 p)
+{
+    float x = std::fmin(std::fmax(p.x * 1024.0f, 0.0f), 1023.0f);
+    float y = std::fmin(std::fmax(p.y * 1024.0f, 0.0f), 1023.0f);
+    float z = std::fmin(std::fmax(p.z * 1024.0f, 0.0f), 1023.0f);
+    return expandBits((unsigned int)x) * 4 + expandBits((unsigned int)y) * 2 + expandBits((unsigned int)z);
+}
@@ -0,0 +1,386 @@
+/*
+PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using std::vector;
+
+//Message channel between processes, one message per call, peers are shard indices.
+//receive blocks until the whole message is there.
+class vTransport
+{
+public:
+    virtual ~vTransport() {}
+    virtual bool send(int peer, const vector<char> &msg) = 0;
+    virtual bool receive(int peer, vector<char> &msg) = 0;
+};
+
+//Unix domain stream sockets, each message is prefixed by its size
+class vSocketTransport : public vTransport
+{
+    std::map<int, int> m_fds; //peer -> socket
+
+public:
+    ~vSocketTransport()
+    {
+        for(std::map<int, int>::iterator it = this->m_fds.begin(); it != this->m_fds.end(); ++it) close(it->second);
+    }
+
+    //the socket is owned by the transport from now on
+    void connect(int peer, int fd)
+    {
+        this->m_fds[peer] = fd;
+    }
+
+    //two connected sockets, to be split between a parent and a forked child
+    static bool socketPair(int &a, int &b)
+    {
+        int fd[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fd) != 0) return false;
+        a = fd[0];
+        b = fd[1];
+        return true;
+    }
+
+    //wait for one peer on 'path', returns the socket or -1
+    static int listenUnix(const std::string &path)
+    {
+        int s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(s < 0) return -1;
+        sockaddr_un addr;
+        if(!address(path, addr)) { close(s); return -1; }
+        unlink(path.c_str());
+        if(bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 1) != 0) { close(s); return -1; }
+        int c = accept(s, NULL, NULL);
+        close(s);
+        unlink(path.c_str());
+        return c;
+    }
+
+    //connect to a listening peer, retrying while it is not up yet
+    static int connectUnix(const std::string &path, int retries = 100)
+    {
+        sockaddr_un addr;
+        if(!address(path, addr)) return -1;
+        for(int i = 0; i < retries; i++)
+        {
+            int s = socket(AF_UNIX, SOCK_STREAM, 0);
+            if(s < 0) return -1;
+            if(::connect(s, (sockaddr*)&addr, sizeof(addr)) == 0) return s;
+            close(s);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return -1;
+    }
+
+    bool send(int peer, const vector<char> &msg)
+    {
+        std::map<int, int>::iterator it = this->m_fds.find(peer);
+        if(it == this->m_fds.end()) return false;
+        unsigned int size = msg.size();
+        return writeAll(it->second, &size, sizeof(size)) && writeAll(it->second, msg.data(), size);
+    }
+
+    bool receive(int peer, vector<char> &msg)
+    {
+        std::map<int, int>::iterator it = this->m_fds.find(peer);
+        if(it == this->m_fds.end()) return false;
+        unsigned int size;
+        if(!readAll(it->second, &size, sizeof(size))) return false;
+        msg.resize(size);
+        return readAll(it->second, msg.data(), size);
+    }
+
+private:
+    static bool address(const std::string &path, sockaddr_un &addr)
+    {
+        if(path.size() >= sizeof(addr.sun_path)) return false;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strcpy(addr.sun_path, path.c_str());
+        return true;
+    }
+
+    static bool writeAll(int fd, const void *data, size_t size)
+    {
+        const char *p = static_cast<const char*>(data);
+        while(size > 0)
+        {
+            ssize_t n = write(fd, p, size);
+            if(n <= 0) return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    static bool readAll(int fd, void *data, size_t size)
+    {
+        char *p = static_cast<char*>(data);
+        while(size > 0)
+        {
+            ssize_t n = read(fd, p, size);
+            if(n <= 0) return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+};
+
+//POSIX shared memory: one mailbox per direction holding a message (or a piece of a message bigger
+//than the mailbox). send waits for the previous piece to be read, receive waits for a new one.
+//The lower index of a pair creates the mailboxes, the other one opens them: a handshake on a random
+//number makes sure it is not attached to a segment left behind by a crashed run.
+//Every wait gives up after 'timeout' (a dead or missing peer): the call returns false. The pieces
+//carry their offset, so the tail of a message given up by one side is skipped by the other one
+class vSharedMemoryTransport : public vTransport
+{
+    struct mailbox
+    {
+        std::atomic<unsigned long long> hello;   //written by the opener
+        std::atomic<unsigned long long> welcome; //the creator copies hello here
+        std::atomic<unsigned int> written;
+        std::atomic<unsigned int> read;
+        unsigned int size;   //of this piece
+        unsigned int offset; //of this piece in the message
+        unsigned int total;  //of the whole message
+        char data[1];
+    };
+
+    struct channel
+    {
+        mailbox * box;
+        size_t bytes;
+        std::string name;
+    };
+
+    std::string m_prefix;
+    int m_self;
+    size_t m_capacity;
+    std::chrono::milliseconds m_timeout;
+    std::map<int, channel> m_out, m_in;
+
+    typedef std::chrono::steady_clock::time_point deadline;
+
+public:
+    //'capacity' is the size of a mailbox in bytes, the same on both sides. bigger messages are split.
+    //'timeoutMs' bounds connect, send and receive
+    vSharedMemoryTransport(const std::string &prefix, int self, size_t capacity = 1 << 20, int timeoutMs = 10000)
+    {
+        this->m_prefix = prefix;
+        this->m_self = self;
+        this->m_capacity = capacity;
+        this->m_timeout = std::chrono::milliseconds(timeoutMs);
+    }
+
+    ~vSharedMemoryTransport()
+    {
+        for(std::map<int, channel>::iterator it = this->m_out.begin(); it != this->m_out.end(); ++it) munmap(it->second.box, it->second.bytes);
+        //the reader removes the name, the memory goes away when both sides unmapped it
+        for(std::map<int, channel>::iterator it = this->m_in.begin(); it != this->m_in.end(); ++it)
+        {
+            munmap(it->second.box, it->second.bytes);
+            shm_unlink(it->second.name.c_str());
+        }
+    }
+
+    //both sides call connect with each other's index, it returns when both are attached
+    bool connect(int peer)
+    {
+        deadline end = std::chrono::steady_clock::now() + this->m_timeout;
+        bool create = this->m_self < peer;
+        channel out, in;
+        //the same order on both sides, each open waits for the other side
+        channel &first = create ? out : in, &second = create ? in : out;
+        if(!open(name(std::min(this->m_self, peer), std::max(this->m_self, peer)), first, create, end))
+        {
+            std::cout << "verlet shm transport -> can't connect to " << peer << std::endl;
+            return false;
+        }
+        if(!open(name(std::max(this->m_self, peer), std::min(this->m_self, peer)), second, create, end))
+        {
+            std::cout << "verlet shm transport -> can't connect to " << peer << std::endl;
+            munmap(first.box, first.bytes);
+            if(create) shm_unlink(first.name.c_str());
+            return false;
+        }
+        this->m_out[peer] = out;
+        this->m_in[peer] = in;
+        return true;
+    }
+
+    bool send(int peer, const vector<char> &msg)
+    {
+        std::map<int, channel>::iterator it = this->m_out.find(peer);
+        if(it == this->m_out.end())
+        {
+            std::cout << "verlet shm transport -> unknown peer " << peer << std::endl;
+            return false;
+        }
+        mailbox * b = it->second.box;
+        deadline end = std::chrono::steady_clock::now() + this->m_timeout;
+        size_t at = 0;
+        do
+        {
+            while(b->written.load(std::memory_order_acquire) != b->read.load(std::memory_order_acquire))
+            {
+                if(std::chrono::steady_clock::now() > end)
+                {
+                    std::cout << "verlet shm transport -> send to " << peer << " timed out" << std::endl;
+                    return false;
+                }
+                std::this_thread::yield();
+            }
+            size_t n = std::min(msg.size() - at, this->m_capacity);
+            b->size = n;
+            b->offset = at;
+            b->total = msg.size();
+            if(n > 0) std::memcpy(b->data, msg.data() + at, n);
+            b->written.fetch_add(1, std::memory_order_release);
+            at += n;
+        } while(at < msg.size());
+        return true;
+    }
+
+    bool receive(int peer, vector<char> &msg)
+    {
+        std::map<int, channel>::iterator it = this->m_in.find(peer);
+        if(it == this->m_in.end()) return false;
+        mailbox * b = it->second.box;
+        deadline end = std::chrono::steady_clock::now() + this->m_timeout;
+        msg.clear();
+        do
+        {
+            while(b->read.load(std::memory_order_acquire) == b->written.load(std::memory_order_acquire))
+            {
+                if(std::chrono::steady_clock::now() > end)
+                {
+                    std::cout << "verlet shm transport -> receive from " << peer << " timed out" << std::endl;
+                    return false;
+                }
+                std::this_thread::yield();
+            }
+            //a piece that doesn't follow: the tail of a message we gave up, or a new one the sender restarted
+            if(b->offset != msg.size())
+            {
+                msg.clear();
+                if(b->offset != 0)
+                {
+                    b->read.fetch_add(1, std::memory_order_release);
+                    continue;
+                }
+            }
+            if(msg.empty()) msg.reserve(b->total);
+            msg.insert(msg.end(), b->data, b->data + b->size);
+            bool last = msg.size() >= b->total;
+            b->read.fetch_add(1, std::memory_order_release);
+            if(last) break;
+        } while(true);
+        return true;
+    }
+
+private:
+    std::string name(int from, int to)
+    {
+        return "/" + this->m_prefix + "_" + std::to_string(from) + "_" + std::to_string(to);
+    }
+
+    bool open(const std::string &n, channel &c, bool create, deadline end)
+    {
+        c.name = n;
+        c.bytes = sizeof(mailbox) + this->m_capacity;
+
+        if(create)
+        {
+            //a segment with this name may be left by a crashed run: start from a new, zeroed one
+            shm_unlink(n.c_str());
+            int fd = shm_open(n.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if(fd < 0) return false;
+            if(ftruncate(fd, c.bytes) != 0)
+            {
+                close(fd);
+                return false;
+            }
+            if(!map(fd, c)) return false;
+
+            //wait for the other side, then answer its number
+            unsigned long long hello;
+            while((hello = c.box->hello.load(std::memory_order_acquire)) == 0)
+            {
+                if(std::chrono::steady_clock::now() > end)
+                {
+                    munmap(c.box, c.bytes);
+                    shm_unlink(n.c_str());
+                    return false;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            c.box->welcome.store(hello, std::memory_order_release);
+            return true;
+        }
+
+        //the name may still be the one of a crashed run, or not be there yet: retry until the creator
+        //answers our number on the segment we mapped
+        unsigned long long hello = ((unsigned long long)getpid() << 32) ^ (unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count();
+        if(hello == 0) hello = 1;
+        while(std::chrono::steady_clock::now() <= end)
+        {
+            int fd = shm_open(n.c_str(), O_RDWR, 0600);
+            if(fd < 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            struct stat st;
+            if(fstat(fd, &st) != 0 || (size_t)st.st_size < c.bytes)
+            {
+                close(fd); //being created
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            if(!map(fd, c)) return false;
+
+            c.box->hello.store(hello, std::memory_order_release);
+            for(int i = 0; i < 200; i++)
+            {
+                if(c.box->welcome.load(std::memory_order_acquire) == hello) return true;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            munmap(c.box, c.bytes); //nobody answered: a stale segment
+        }
+        return false;
+    }
+
+    //takes the descriptor. a new segment is zeroed: no message written, none read
+    bool map(int fd, channel &c)
+    {
+        void * p = mmap(NULL, c.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if(p == MAP_FAILED) return false;
+        c.box = static_cast<mailbox*>(p);
+        return true;
+    }
+};
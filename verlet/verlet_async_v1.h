@@ -0,0 +1,184 @@
+/*
+VERLET PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+//Physics class
+#include <physics/verlet/verlet_physics_v1.h>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <cstring>
+
+//Steps a world on its own thread while the caller keeps going (rendering, game logic).
+//stepAsync starts a step and returns, wait blocks until it is done. While a step runs the
+//world must not be touched: readers use read(), the state of the last completed step, and
+//writes (forces, spawns, ...) are posted and applied on the physics thread right before the
+//next step, so the results don't depend on the timing of the threads. When no step is running (after wait) the world can be used directly.
+class vAsyncPhysics
+{
+public:
+    //state of one completed step, row i of 'transforms' is the body with id ids[i]
+    struct view
+    {
+        int frame = 0;
+        int count = 0;
+        int stride = 0;
+        vector<float> transforms; //vPhysics::setTransformOutput layout
+        vector<int> ids;
+    };
+
+private:
+    vPhysics * m_world;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_start, m_done;
+    bool m_requested = false, m_busy = false, m_quit = false;
+    float m_dt = .0f;
+
+    //triple buffer: the physics thread fills m_views[m_back], then swaps it with the shared
+    //slot; read() swaps the shared slot with m_views[m_front] if it holds a newer frame
+    view m_views[3];
+    int m_front = 0, m_back = 1;
+    std::atomic<int> m_shared; //index, FRESH bit set when it has not been read yet
+    static const int FRESH = 4;
+
+    std::mutex m_writesMutex;
+    vector<std::function<void(vPhysics&)>> m_writes, m_applying;
+
+public:
+    //the world is not owned, its transform output is set to 'format'
+    vAsyncPhysics(vPhysics * world, vPhysics::TransformFormat format = vPhysics::TRANSFORM_POS_QUAT)
+    {
+        this->m_world = world;
+        this->m_world->setTransformOutput(format);
+        this->m_shared.store(2);
+
+        //the views start with the current state
+        publish();
+        this->read();
+
+        this->m_thread = std::thread([this]() { this->run(); });
+    }
+
+    ~vAsyncPhysics()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+            this->m_quit = true;
+        }
+        this->m_start.notify_all();
+        this->m_thread.join();
+    }
+
+    vAsyncPhysics(const vAsyncPhysics&) = delete;
+
+    vAsyncPhysics& operator=(const vAsyncPhysics&) = delete;
+
+    //start a step and return. if the previous one is still running it waits for it first
+    void stepAsync(float dt)
+    {
+        std::unique_lock<std::mutex> lock(this->m_mutex);
+        this->m_done.wait(lock, [this]() { return !this->m_requested && !this->m_busy; });
+        this->m_dt = dt;
+        this->m_requested = true;
+
+        //the writes posted until now belong to this step, the next ones to the following step
+        {
+            std::lock_guard<std::mutex> writes(this->m_writesMutex);
+            this->m_applying.swap(this->m_writes);
+        }
+        lock.unlock();
+        this->m_start.notify_all();
+    }
+
+    //block until the running step (if any) is done
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(this->m_mutex);
+        this->m_done.wait(lock, [this]() { return !this->m_requested && !this->m_busy; });
+    }
+
+    bool isBusy()
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        return this->m_requested || this->m_busy;
+    }
+
+    //applied in order on the physics thread before the step started by the next stepAsync. safe from any thread
+    void post(const std::function<void(vPhysics&)> &write)
+    {
+        std::lock_guard<std::mutex> lock(this->m_writesMutex);
+        this->m_writes.push_back(write);
+    }
+
+    //the last completed step, valid until the next call to read (from a single reader thread)
+    const view& read()
+    {
+        if(this->m_shared.load(std::memory_order_relaxed) & FRESH)
+            this->m_front = this->m_shared.exchange(this->m_front, std::memory_order_acq_rel) & ~FRESH;
+        return this->m_views[this->m_front];
+    }
+
+    //direct access, only when no step is running
+    vPhysics* getWorld() { return this->m_world; }
+
+private:
+    void run()
+    {
+        while(true)
+        {
+            float dt;
+            {
+                std::unique_lock<std::mutex> lock(this->m_mutex);
+                this->m_start.wait(lock, [this]() { return this->m_quit || this->m_requested; });
+                if(this->m_quit) return;
+                this->m_requested = false;
+                this->m_busy = true;
+                dt = this->m_dt;
+            }
+
+            applyWrites();
+            this->m_world->step(dt);
+            publish();
+
+            {
+                std::lock_guard<std::mutex> lock(this->m_mutex);
+                this->m_busy = false;
+            }
+            this->m_done.notify_all();
+        }
+    }
+
+    void applyWrites()
+    {
+        for(int i = 0; i < this->m_applying.size(); i++) this->m_applying[i](*this->m_world);
+        this->m_applying.clear();
+    }
+
+    void publish()
+    {
+        view &v = this->m_views[this->m_back];
+        vector<vRigidBody*> * bodies = this->m_world->getRigidBodies();
+
+        v.frame = this->m_world->getFrame();
+        v.count = this->m_world->getTransformCount();
+        v.stride = this->m_world->getTransformStride();
+        v.transforms.resize(v.count * v.stride);
+        if(v.count > 0) std::memcpy(v.transforms.data(), this->m_world->getTransforms(), v.transforms.size() * sizeof(float));
+        v.ids.resize(v.count);
+        for(int i = 0; i < v.count; i++) v.ids[i] = bodies->at(i)->getId();
+
+        this->m_back = this->m_shared.exchange(this->m_back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+    }
+};
@@ -23,13 +23,31 @@ public:
         //free(m_pb);
     }*/
 
+    //the particles have been copied from the array starting at 'from' to the one starting at 'to'
+    void rebind(vParticle * from, vParticle * to)
+    {
+        m_pa = to + (m_pa - from);
+        m_pb = to + (m_pb - from);
+    }
+
     //this function returns the difference of original and actual distance between two particles.
     void enforceConstraint()
     {
-        glm::vec3 d = m_pb->getPosition() - m_pa->getPosition();
-        float delta =  glm::length(d) - m_length;
+        glm::vec3 a = m_pa->getPosition();
+        glm::vec3 b = m_pb->getPosition();
+        project(a, b, m_pb->getMass()/(m_pa->getMass()+m_pb->getMass()), m_pa->getMass()/(m_pa->getMass()+m_pb->getMass()), m_length);
+        m_pa->setPosition(a);
+        m_pb->setPosition(b);
+    }
+
+    //distance constraint kernel, ka and kb are the shares of the correction taken by a and b
+    //(shared with vSoftBody, which keeps its particles and constraints in flat arrays)
+    static void project(glm::vec3 &a, glm::vec3 &b, float ka, float kb, float length)
+    {
+        glm::vec3 d = b - a;
+        float delta =  glm::length(d) - length;
         glm::vec3 nd = glm::normalize(d);
-        m_pa->setPosition(m_pa->getPosition() + (m_pb->getMass()/(m_pa->getMass()+m_pb->getMass())) * delta * nd);
-        m_pb->setPosition(m_pb->getPosition() - (m_pa->getMass()/(m_pa->getMass()+m_pb->getMass())) * delta * nd);
+        a = a + ka * delta * nd;
+        b = b - kb * delta * nd;
     }
 };
\ No newline at end of file
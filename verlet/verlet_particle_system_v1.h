@@ -0,0 +1,498 @@
+/*
+VERLET PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+//Physics class
+#include <physics/verlet/verlet_rb_v1.h>
+#include <physics/collision_v1.h>
+#include <physics/thread_pool_v1.h>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+//Bare particles for granular matter and debris: no rigidbody, no vtable, no connections.
+//The state lives in SoA buffers (32 bytes per particle, no heap object), the particles
+//collide with each other through a hashed uniform grid and with the rigidbodies of the world
+//through the sphere tests of vRigidBody and Collision::reflectpatricle.
+//The coupling is one way: the particles bounce on the bodies, the bodies are not pushed.
+class vParticleSystem
+{
+    //cell of the grid, stored per particle to skip the hash collisions
+    struct cell
+    {
+        int x, y, z;
+
+        bool operator==(const cell &c) const { return x == c.x && y == c.y && z == c.z; }
+    };
+
+    //SoA state
+    vTaggedVector<vec3, MEMORY_PARTICLES> m_pos, m_old;
+    vTaggedVector<float, MEMORY_PARTICLES> m_radius, m_invMass;
+
+    //grid: the particles themselves are kept sorted by bucket (neighbours are close in memory),
+    //m_start[b] .. m_start[b+1] are the particles of bucket b
+    vTaggedVector<cell, MEMORY_PARTICLES> m_cell, m_tmpCell;
+    vTaggedVector<unsigned int, MEMORY_PARTICLES> m_bucket;
+    vTaggedVector<int, MEMORY_PARTICLES> m_start;
+    vTaggedVector<int, MEMORY_PARTICLES> m_sorted;
+    vTaggedVector<vec3, MEMORY_PARTICLES> m_delta, m_tmpPos, m_tmpOld;
+    vTaggedVector<float, MEMORY_PARTICLES> m_tmpRadius, m_tmpInvMass;
+    float m_cellSize = 0;
+    float m_maxRadius = 0;
+
+    float m_worldSize;
+    float m_dt = 1.0f/60.0f;
+
+    vThreadPool * m_pool;
+
+public:
+    //shared by all the particles of the system
+    float drag = .5f;
+    float bounciness = .5f;
+    bool gravity = true;
+    bool selfCollisions = true;
+    bool bodyCollisions = true;
+    int iterations = 1; //self collision passes per step
+
+    vParticleSystem(float worldSize, vThreadPool * pool = &vThreadPool::global())
+    {
+        this->m_worldSize = worldSize;
+        this->m_pool = pool;
+    }
+
+    int size()
+    {
+        return this->m_pos.size();
+    }
+
+    void reserve(int count)
+    {
+        this->m_pos.reserve(count);
+        this->m_old.reserve(count);
+        this->m_radius.reserve(count);
+        this->m_invMass.reserve(count);
+    }
+
+    //add 'count' particles, vel may be NULL. returns the index of the first one
+    //indices are valid until the next step: particles are sorted by cell every step
+    //and kill moves the last particles in the free places
+    int spawn(int count, const vec3 * pos, const vec3 * vel, float radius, float mass)
+    {
+        int first = this->m_pos.size();
+        int n = first + count;
+        this->m_pos.resize(n);
+        this->m_old.resize(n);
+        this->m_radius.resize(n, radius);
+        this->m_invMass.resize(n, mass > 0 ? 1.0f/mass : .0f);
+
+        for(int i = 0; i < count; i++)
+        {
+            this->m_pos[first+i] = pos[i];
+            this->m_old[first+i] = vel ? pos[i] - vel[i]*this->m_dt : pos[i];
+        }
+
+        if(radius > this->m_maxRadius) this->m_maxRadius = radius;
+        return first;
+    }
+
+    //burst of 'count' particles around 'origin' (inside a cube of half side 'spread'),
+    //each with 'velocity' plus a random part of size up to 'jitter'. fixed seed -> same burst
+    int emit(int count, vec3 origin, float spread, vec3 velocity, float jitter, float radius, float mass, unsigned int seed = 1)
+    {
+        vector<vec3> pos(count), vel(count);
+        unsigned int s = seed ? seed : 1;
+        for(int i = 0; i < count; i++)
+        {
+            pos[i] = origin + vec3(random(s), random(s), random(s))*spread;
+            vel[i] = velocity + vec3(random(s), random(s), random(s))*jitter;
+        }
+        return spawn(count, pos.data(), vel.data(), radius, mass);
+    }
+
+    //remove the particles at the given indices
+    void kill(vector<int> indices)
+    {
+        std::sort(indices.begin(), indices.end());
+        indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+        //from the back so the swapped in particles are never in the list
+        for(int i = (int)indices.size()-1; i >= 0; i--)
+            if(indices[i] >= 0 && indices[i] < this->m_pos.size()) remove(indices[i]);
+    }
+
+    //remove every particle for which f(position, velocity) is true, keeps the order of the others.
+    //returns the number of removed particles
+    template <class F> int killIf(F f)
+    {
+        int n = this->m_pos.size(), k = 0;
+        for(int i = 0; i < n; i++)
+        {
+            if(f(this->m_pos[i], this->getVelocity(i))) continue;
+            this->m_pos[k] = this->m_pos[i];
+            this->m_old[k] = this->m_old[i];
+            this->m_radius[k] = this->m_radius[i];
+            this->m_invMass[k] = this->m_invMass[i];
+            k++;
+        }
+        resize(k);
+        return n - k;
+    }
+
+    void clear()
+    {
+        resize(0);
+        this->m_maxRadius = 0;
+    }
+
+    void step(float dt, vector<vRigidBody*> * bodies = NULL)
+    {
+        this->m_dt = dt;
+        int n = this->m_pos.size();
+        if(n == 0) return;
+
+        integrate(n, this->m_pos.data(), this->m_old.data(), this->m_radius.data(), this->m_invMass.data(),
+                  dt, this->gravity, this->drag, this->bounciness, this->m_worldSize, this->m_pool);
+
+        if(this->selfCollisions)
+            for(int i = 0; i < this->iterations; i++)
+            {
+                buildGrid();
+                solveSelf();
+            }
+
+        if(this->bodyCollisions && bodies)
+        {
+            if(!this->selfCollisions || this->iterations < 1) buildGrid();
+            for(int i = 0; i < bodies->size(); i++) if(!bodies->at(i)->isTrigger()) collide(bodies->at(i));
+        }
+    }
+
+    //raw buffers, to upload to the gpu as they are
+    const vec3* getPositions() { return this->m_pos.data(); }
+
+    const float* getRadii() { return this->m_radius.data(); }
+
+    vec3 getPosition(int i) { return this->m_pos[i]; }
+
+    vec3 getVelocity(int i) { return (this->m_pos[i] - this->m_old[i]) / this->m_dt; }
+
+    float getRadius(int i) { return this->m_radius[i]; }
+
+    void setPosition(int i, vec3 pos, vec3 vel)
+    {
+        this->m_pos[i] = pos;
+        this->m_old[i] = pos - vel*this->m_dt;
+    }
+
+private:
+    //xorshift, uniform in [-1, 1]
+    static float random(unsigned int &s)
+    {
+        s ^= s << 13;
+        s ^= s >> 17;
+        s ^= s << 5;
+        return (s & 0xFFFFFF) / (float)0x800000 - 1.0f;
+    }
+
+    void resize(int n)
+    {
+        this->m_pos.resize(n);
+        this->m_old.resize(n);
+        this->m_radius.resize(n);
+        this->m_invMass.resize(n);
+    }
+
+    void remove(int i)
+    {
+        int last = this->m_pos.size()-1;
+        this->m_pos[i] = this->m_pos[last];
+        this->m_old[i] = this->m_old[last];
+        this->m_radius[i] = this->m_radius[last];
+        this->m_invMass[i] = this->m_invMass[last];
+        resize(last);
+    }
+
+    cell cellOf(vec3 p)
+    {
+        float inv = 1.0f / this->m_cellSize;
+        return cell{ (int)std::floor(p.x*inv), (int)std::floor(p.y*inv), (int)std::floor(p.z*inv) };
+    }
+
+    unsigned int hash(cell c)
+    {
+        return ((unsigned int)c.x*73856093u ^ (unsigned int)c.y*19349663u ^ (unsigned int)c.z*83492791u) & (this->m_start.size()-2);
+    }
+
+    //counting sort of the particles by bucket
+    void buildGrid()
+    {
+        int n = this->m_pos.size();
+        this->m_cellSize = std::max(2.0f*this->m_maxRadius, 0.001f);
+
+        //power of two buckets, at least 2 per particle (+1 for the end of the last one)
+        int buckets = 1;
+        while(buckets < 2*n) buckets *= 2;
+        this->m_start.assign(buckets+1, 0);
+        this->m_cell.resize(n);
+        this->m_bucket.resize(n);
+        this->m_sorted.resize(n);
+
+        this->m_pool->parallelFor(n, [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++)
+            {
+                this->m_cell[i] = cellOf(this->m_pos[i]);
+                this->m_bucket[i] = hash(this->m_cell[i]);
+            }
+        }, 1024);
+
+        for(int i = 0; i < n; i++) this->m_start[this->m_bucket[i]+1]++;
+        for(int i = 0; i < buckets; i++) this->m_start[i+1] += this->m_start[i];
+        vector<int> next(this->m_start.begin(), this->m_start.end()-1);
+        for(int i = 0; i < n; i++) this->m_sorted[next[this->m_bucket[i]]++] = i;
+
+        //move the particles in bucket order
+        this->m_tmpPos.resize(n);
+        this->m_tmpOld.resize(n);
+        this->m_tmpRadius.resize(n);
+        this->m_tmpInvMass.resize(n);
+        this->m_tmpCell.resize(n);
+        this->m_pool->parallelFor(n, [&](int begin, int end)
+        {
+            for(int k = begin; k < end; k++)
+            {
+                int i = this->m_sorted[k];
+                this->m_tmpPos[k] = this->m_pos[i];
+                this->m_tmpOld[k] = this->m_old[i];
+                this->m_tmpRadius[k] = this->m_radius[i];
+                this->m_tmpInvMass[k] = this->m_invMass[i];
+                this->m_tmpCell[k] = this->m_cell[i];
+            }
+        }, 1024);
+        this->m_pos.swap(this->m_tmpPos);
+        this->m_old.swap(this->m_tmpOld);
+        this->m_radius.swap(this->m_tmpRadius);
+        this->m_invMass.swap(this->m_tmpInvMass);
+        this->m_cell.swap(this->m_tmpCell);
+    }
+
+    //jacobi projection: every particle moves only itself, summing its corrections from the
+    //overlapping neighbours, so the particles are processed in parallel with no race
+    void solveSelf()
+    {
+        int n = this->m_pos.size();
+        this->m_delta.resize(n);
+
+        this->m_pool->parallelFor(n, [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++)
+            {
+                vec3 d(.0f, .0f, .0f);
+                float wi = this->m_invMass[i];
+                if(wi > 0)
+                {
+                    cell c = this->m_cell[i];
+                    for(int x = -1; x <= 1; x++)
+                    for(int y = -1; y <= 1; y++)
+                    for(int z = -1; z <= 1; z++)
+                    {
+                        cell nc = cell{ c.x+x, c.y+y, c.z+z };
+                        unsigned int b = hash(nc);
+                        for(int k = this->m_start[b]; k < this->m_start[b+1]; k++)
+                        {
+                            int j = k;
+                            if(j == i || !(this->m_cell[j] == nc)) continue;
+
+                            vec3 v = this->m_pos[i] - this->m_pos[j];
+                            float r = this->m_radius[i] + this->m_radius[j];
+                            float l2 = glm::dot(v, v);
+                            if(l2 >= r*r || l2 == 0) continue;
+
+                            float l = std::sqrt(l2);
+                            float w = wi / (wi + this->m_invMass[j]);
+                            d += v * ((r - l) / l * w);
+                        }
+                    }
+                }
+                this->m_delta[i] = d;
+            }
+        }, 512);
+
+        this->m_pool->parallelFor(n, [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++) this->m_pos[i] += this->m_delta[i];
+        }, 1024);
+    }
+
+    //particles near the bounds of the body, the grid is walked if the body spans less cells
+    //than there are particles, otherwise the particles are scanned
+    void gather(vec3 min, vec3 max, vector<int> &result)
+    {
+        int n = this->m_pos.size();
+        min -= vec3(this->m_maxRadius, this->m_maxRadius, this->m_maxRadius);
+        max += vec3(this->m_maxRadius, this->m_maxRadius, this->m_maxRadius);
+        cell lo = cellOf(min), hi = cellOf(max);
+        double cells = (double)(hi.x-lo.x+1) * (hi.y-lo.y+1) * (hi.z-lo.z+1);
+
+        if(cells >= n)
+        {
+            for(int i = 0; i < n; i++)
+            {
+                vec3 p = this->m_pos[i];
+                if(p.x >= min.x && p.x <= max.x && p.y >= min.y && p.y <= max.y && p.z >= min.z && p.z <= max.z) result.push_back(i);
+            }
+            return;
+        }
+
+        for(int x = lo.x; x <= hi.x; x++)
+        for(int y = lo.y; y <= hi.y; y++)
+        for(int z = lo.z; z <= hi.z; z++)
+        {
+            cell c = cell{ x, y, z };
+            unsigned int b = hash(c);
+            for(int k = this->m_start[b]; k < this->m_start[b+1]; k++)
+                if(this->m_cell[k] == c) result.push_back(k);
+        }
+    }
+
+    void collide(vRigidBody * rb)
+    {
+        vec3 min, max;
+        rb->getBounds(min, max);
+        vector<int> candidates;
+        gather(min, max, candidates);
+        collideBody(rb, candidates, this->m_pos.data(), this->m_old.data(), this->m_radius.data(), this->m_invMass.data(), this->bounciness, this->m_pool);
+    }
+
+public:
+    //kernels on raw SoA buffers, shared with vSoftBody
+
+    //same integration and world bounds of SphereParticle
+    static void integrate(int n, vec3 * pos, vec3 * old, const float * radius, const float * invMass,
+                          float dt, bool gravity, float drag, float bounciness, float worldSize, vThreadPool * pool)
+    {
+        vec3 acc = gravity ? vec3(.0f, -9.81f, .0f) : vec3(.0f, .0f, .0f);
+        float dump = 1.0f-drag*dt;
+        float ws = worldSize;
+        float b = bounciness;
+
+        pool->parallelFor(n, [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++)
+            {
+                vec3 p = pos[i];
+                vec3 o = old[i];
+                //particles with infinite mass are pinned
+                vec3 s = invMass[i] > 0 ? (1.0f+dump)*p - dump*o + acc*dt*dt : p;
+                float r = radius[i];
+
+                for(int k = 0; k < 3; k++)
+                {
+                    if(s[k] + r > ws) { p[k] = (ws - r) + (s[k] - p[k])*b; s[k] = ws - r; }
+                    if(r - s[k] > ws) { p[k] = (r - ws) + (s[k] - p[k])*b; s[k] = r - ws; }
+                }
+
+                old[i] = p;
+                pos[i] = s;
+            }
+        }, 1024);
+    }
+
+    //the candidate particles vs one rigidbody, each candidate is touched by one task only
+    static void collideBody(vRigidBody * rb, const vector<int> &candidates, vec3 * pos, vec3 * old,
+                            const float * radius, const float * invMass, float bounciness, vThreadPool * pool)
+    {
+        if(candidates.empty()) return;
+
+        bool isBox = rb->isBox();
+        vRigidBody::box b;
+        vRigidBody::sphere s;
+        if(isBox) b = dynamic_cast<Box*>(rb)->getBox();
+        else s = dynamic_cast<Sphere*>(rb)->getSphere();
+        vec3 vel = rb->getVelocity();
+        float mass = rb->getEffectiveMass();
+
+        pool->parallelFor(candidates.size(), [&](int begin, int end)
+        {
+            for(int k = begin; k < end; k++)
+            {
+                int i = candidates[k];
+                if(invMass[i] == 0) continue;
+                vec3 p = pos[i];
+                float r = radius[i];
+                vec3 q, normal;
+
+                if(isBox)
+                {
+                    if(!vRigidBody::sphere::collide(vRigidBody::sphere::create(p, r), b, q)) continue;
+                    q = vRigidBody::box::closestPoint(b, p);
+                    if(q == p) insideBox(b, p, q, normal);
+                    else normal = glm::normalize(p - q);
+                }
+                else
+                {
+                    if(!vRigidBody::sphere::collide(vRigidBody::sphere::create(p, r), s, q)) continue;
+                    vec3 v = p - s.pos;
+                    if(glm::dot(v, v) == 0) v = vec3(.0f, 1.0f, .0f);
+                    normal = glm::normalize(v);
+                    q = s.pos + normal*s.r;
+                }
+
+                resolve(pos[i], old[i], r, invMass[i], q, normal, vel, mass, bounciness);
+            }
+        }, 256);
+    }
+
+private:
+    //center inside the box: the closest face is the way out
+    static void insideBox(const vRigidBody::box &b, vec3 p, vec3 &q, vec3 &normal)
+    {
+        vec3 v = p - b.position;
+        vec3 axis[3] = { b.x, b.y, b.z };
+        float half[3] = { b.w, b.h, b.d };
+        int best = 0;
+        float depth = 0;
+        for(int k = 0; k < 3; k++)
+        {
+            float d = half[k] - std::abs(glm::dot(v, axis[k]));
+            if(k == 0 || d < depth) { depth = d; best = k; }
+        }
+        normal = glm::dot(v, axis[best]) < 0 ? -axis[best] : axis[best];
+        q = p + normal*depth;
+    }
+
+    //push the particle out along the normal, the approaching particles are reflected
+    //(Collision::reflectpatricle) and lose part of the normal velocity
+    static void resolve(vec3 &pos, vec3 &old, float r, float invMass, vec3 q, vec3 normal, vec3 vel, float mass, float bounciness)
+    {
+        vec3 p = pos;
+        vec3 o = old;
+        vec3 surface = q + normal*r;
+
+        if(glm::dot((p - o) - vel, normal) >= 0)
+        {
+            //already leaving: only the position is fixed
+            vec3 d = normal * glm::dot(surface - p, normal);
+            pos = p + d;
+            old = o + d;
+            return;
+        }
+
+        //the particle is reflected from the surface keeping its velocity
+        vec3 out, outOld;
+        Collision::reflectpatricle(out, outOld, surface, surface - (p - o), 1.0f/invMass, vel, mass, q, normal, r);
+
+        //restitution: keep 'bounciness' of the reflected normal velocity
+        vec3 v1 = out - outOld;
+        float vn = glm::dot(v1 - vel, normal);
+        v1 -= normal * (vn * (1.0f - bounciness));
+        pos = out;
+        old = out - v1;
+    }
+};
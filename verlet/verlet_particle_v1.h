@@ -32,9 +32,9 @@ protected:
     vec3 m_pNow;
     vec3 m_pOld;
 
-    float m_dt;
+    float m_dt = .0f;
 
-    vec3 m_forces;
+    vec3 m_forces = vec3(.0f, .0f, .0f);
 
     float m_mass;
     float m_drag;
@@ -108,9 +108,10 @@ public:
         m_forces = vec3(0.0f,0.0f,0.0f);
     }
 
+    //forces add up until the next update
     void applyForce(vec3 f)
     {
-        this->m_forces = f;
+        this->m_forces += f;
     }
 
     vec3 getPosition()
@@ -125,6 +126,7 @@ public:
 
     vec3 getVelocity()
     {
+        if(this->m_dt <= .0f) return vec3(.0f, .0f, .0f); //never updated
         return (this->m_pNow-this->m_pOld)/this->m_dt;
     }
 
@@ -144,6 +146,12 @@ public:
         return this->m_dt;
     }
 
+    //dt of the last update, restored with the positions by a rollback
+    void setDt(float dt)
+    {
+        this->m_dt = dt;
+    }
+
     float getMass()
     {
         return this->m_mass;
@@ -153,6 +161,21 @@ public:
     {
         return this->m_radius;
     }
+
+    float getDrag()
+    {
+        return this->m_drag;
+    }
+
+    float getBounciness()
+    {
+        return this->m_bounciness;
+    }
+
+    bool hasGravity()
+    {
+        return this->m_gravity;
+    }
 protected:
     vec3 apply_gravity()
     {
@@ -0,0 +1,213 @@
+/*
+VERLET PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+//Physics class
+#include <physics/verlet/verlet_physics_v1.h>
+#include <physics/thread_pool_v1.h>
+
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <cstring>
+
+//Many small independent worlds with the same settings stepped together (training environments,
+//server shards). The worlds are split among the threads of one pool (a world per task, the loops
+//inside vPhysics run inline in the task), and after every step each world writes its bodies in a
+//single observation tensor of shape [worlds][maxBodies][OBS_CHANNELS], read with no copy.
+//After setup and reset the particles of all the worlds are packed in one shared array, world after
+//world, and their connections in another (see vPhysics::packBodies); each world keeps its own
+//collision solver. Bodies added or removed later by hand live outside the arrays until the next pack.
+//The worlds are never reordered (vPhysics::setReorderInterval): a reorder would move a world to
+//arrays of its own and change the order of its rows in the observations. step turns it off.
+class vPhysicsBatch
+{
+    vector<vPhysics*> m_worlds;
+
+    //shared state, retained by the batch, and the first particle of each world in it
+    vMemoryBlock * m_particles = NULL;
+    vMemoryBlock * m_connections = NULL;
+    vector<int> m_firstParticle;
+    float m_worldSize;
+    int m_maxBodies;
+
+    //observation tensor + number of valid rows of each world
+    vector<float> m_obs;
+    vector<int> m_bodyCount;
+
+    std::function<void(vPhysics&, int)> m_setup;
+    vThreadPool * m_pool;
+
+    double m_lastStep = 0; //seconds
+    int m_lastSubsteps = 0;
+
+public:
+    //position, velocity (per step, as vRigidBody::getVelocity)
+    static const int OBS_CHANNELS = 6;
+
+    vPhysicsBatch(int worlds, float worldSize, int maxBodies, CollisionSolver::BroadPhase broadPhase = CollisionSolver::OCTREE, vThreadPool * pool = &vThreadPool::global())
+    {
+        this->m_worldSize = worldSize;
+        this->m_maxBodies = maxBodies;
+        this->m_pool = pool;
+
+        this->m_worlds.resize(worlds);
+        for(int i = 0; i < worlds; i++)
+        {
+            this->m_worlds[i] = new vPhysics();
+            this->m_worlds[i]->setWorld(worldSize);
+            this->m_worlds[i]->getCollisionSolver()->broadPhase = broadPhase;
+        }
+
+        this->m_obs.assign((size_t)worlds * maxBodies * OBS_CHANNELS, .0f);
+        this->m_bodyCount.assign(worlds, 0);
+    }
+
+    ~vPhysicsBatch()
+    {
+        for(int i = 0; i < this->m_worlds.size(); i++) delete this->m_worlds[i];
+        if(this->m_particles) this->m_particles->release();
+        if(this->m_connections) this->m_connections->release();
+    }
+
+    vPhysicsBatch(const vPhysicsBatch&) = delete;
+
+    vPhysicsBatch& operator=(const vPhysicsBatch&) = delete;
+
+    int size() { return this->m_worlds.size(); }
+
+    vPhysics* getWorld(int i) { return this->m_worlds[i]; }
+
+    //fn(world, index) fills one world, it is called in parallel (a world per task) and again on reset
+    void setup(const std::function<void(vPhysics&, int)> &fn)
+    {
+        this->m_setup = fn;
+        this->m_pool->parallelFor(this->m_worlds.size(), [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++)
+            {
+                fn(*this->m_worlds[i], i);
+                observe(i);
+            }
+        }, 1);
+        pack();
+    }
+
+    //rebuild some worlds from the setup function (finished episodes)
+    void reset(const vector<int> &worlds)
+    {
+        this->m_pool->parallelFor(worlds.size(), [&](int begin, int end)
+        {
+            for(int k = begin; k < end; k++)
+            {
+                int i = worlds[k];
+                this->m_worlds[i]->cleanWorld();
+                if(this->m_setup) this->m_setup(*this->m_worlds[i], i);
+                observe(i);
+            }
+        }, 1);
+        pack();
+    }
+
+    void reset(int world)
+    {
+        reset(vector<int>(1, world));
+    }
+
+    void step(float dt, int substeps = 1)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        for(int i = 0; i < this->m_worlds.size(); i++)
+            if(this->m_worlds[i]->getReorderInterval() > 0)
+            {
+                std::cout << "verlet batch -> world " << i << " can't be reordered, reorder interval ignored" << std::endl;
+                this->m_worlds[i]->setReorderInterval(0);
+            }
+
+        this->m_pool->parallelFor(this->m_worlds.size(), [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++)
+            {
+                for(int s = 0; s < substeps; s++) this->m_worlds[i]->step(dt);
+                observe(i);
+            }
+        }, 1);
+
+        this->m_lastStep = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        this->m_lastSubsteps = substeps;
+    }
+
+    //[worlds][maxBodies][OBS_CHANNELS], rows after getBodyCounts()[w] are zero
+    const float* getObservations() { return this->m_obs.data(); }
+
+    const float* getObservations(int world) { return this->m_obs.data() + (size_t)world * this->m_maxBodies * OBS_CHANNELS; }
+
+    const int* getBodyCounts() { return this->m_bodyCount.data(); }
+
+    int getMaxBodies() { return this->m_maxBodies; }
+
+    //move the particles and the connections of all the worlds in two new shared arrays, world
+    //after world and in the order of their bodies. done by setup and reset, not while stepping
+    void pack()
+    {
+        size_t particles = 0, connections = 0;
+        this->m_firstParticle.resize(this->m_worlds.size() + 1);
+        for(int i = 0; i < this->m_worlds.size(); i++)
+        {
+            size_t p, c;
+            this->m_worlds[i]->getStorage(p, c);
+            this->m_firstParticle[i] = particles / sizeof(vParticle);
+            particles += p;
+            connections += c;
+        }
+        this->m_firstParticle.back() = particles / sizeof(vParticle);
+
+        if(this->m_particles) this->m_particles->release();
+        if(this->m_connections) this->m_connections->release();
+        this->m_particles = vMemoryBlock::create(MEMORY_PARTICLES, particles);
+        this->m_connections = vMemoryBlock::create(MEMORY_CONNECTIONS, connections);
+
+        //in order, so that each world is a contiguous range
+        for(int i = 0; i < this->m_worlds.size(); i++) this->m_worlds[i]->packBodies(this->m_particles, this->m_connections);
+    }
+
+    //the particles of all the worlds as packed by the last pack, world w is in
+    //[getFirstParticle(w), getFirstParticle(w+1)). getFirstParticle(size()) is the total
+    vParticle* getParticles() { return this->m_particles ? reinterpret_cast<vParticle*>(this->m_particles->data()) : NULL; }
+
+    int getFirstParticle(int world) { return this->m_firstParticle[world]; }
+
+    //throughput of the last step
+    double getWorldStepsPerSecond()
+    {
+        return this->m_lastStep > 0 ? this->m_worlds.size() * this->m_lastSubsteps / this->m_lastStep : 0;
+    }
+
+private:
+    //bodies past maxBodies are not observed
+    void observe(int w)
+    {
+        vector<vRigidBody*> * bodies = this->m_worlds[w]->getRigidBodies();
+        int n = bodies->size() < this->m_maxBodies ? bodies->size() : this->m_maxBodies;
+        float * o = this->m_obs.data() + (size_t)w * this->m_maxBodies * OBS_CHANNELS;
+
+        for(int i = 0; i < n; i++)
+        {
+            vRigidBody * rb = bodies->at(i);
+            vec3 p = rb->getPosition();
+            vec3 v = rb->getVelocity();
+            float * row = o + i * OBS_CHANNELS;
+            row[0] = p.x; row[1] = p.y; row[2] = p.z;
+            row[3] = v.x; row[4] = v.y; row[5] = v.z;
+        }
+        if(n < this->m_bodyCount[w]) std::memset(o + n * OBS_CHANNELS, 0, (this->m_bodyCount[w] - n) * OBS_CHANNELS * sizeof(float));
+        this->m_bodyCount[w] = n;
+    }
+};
@@ -12,10 +12,19 @@ using namespace std;
 
 //Physics class
 #include <physics/verlet/verlet_rb_v1.h>
+#include <physics/verlet/verlet_rollback_v1.h>
+#include <physics/verlet/verlet_particle_system_v1.h>
+#include <physics/verlet/verlet_soft_body_v1.h>
 #include <physics/collision_solver_v1.h>
+#include <physics/thread_pool_v1.h>
+#include <physics/queue_v1.h>
+#include <physics/state_publisher_v1.h>
+#include <physics/memory_v1.h>
+#include <physics/tools_v1.h>
 
 //for_each loop
 #include<algorithm>
+#include <cfloat>
 
 class vPhysics
 {
@@ -23,13 +32,49 @@ class vPhysics
 typedef glm::vec3 vec3;
 float m_worldSize;
 vector<vRigidBody*> m_rBodies;
-int m_countRb;
+int m_countRb; //next never used id
+
+//body id -> position in m_rBodies. ids of removed bodies are recycled,
+//the generation tells apart handles to the old and the new body
+struct slot
+{
+    int index = -1;
+    unsigned generation = 0;
+};
+vector<slot> m_slots;
+vector<int> m_freeIds;
 
 static const int COLLISION_SOLVER = 1;
-CollisionSolver * m_colSolv;
+CollisionSolver * m_colSolv = NULL;
+
+int m_frame = 0;
+vRollback * m_rollback = NULL;
+
+int m_reorderInterval = 0; //steps between two spatial reorders, 0 = never
+
+vector<vParticleSystem*> m_particleSystems;
+vector<vSoftBody*> m_softBodies;
 
 public:
-    vPhysics(){}
+    vPhysics()
+    {
+        vMemory::global().addWorld();
+    }
+
+    //with vMemory's leak check on, the last world destroyed reports the memory still allocated
+    ~vPhysics()
+    {
+        if(this->m_colSolv) cleanWorld();
+        delete this->m_colSolv;
+        delete this->m_rollback;
+        delete this->m_commands.load();
+        delete this->m_publisher;
+        vMemory::global().removeWorld();
+    }
+
+    vPhysics(const vPhysics&) = delete; //owns the bodies
+
+    vPhysics& operator=(const vPhysics&) = delete;
 
     struct spherePrefab
     {
@@ -42,6 +87,10 @@ public:
         float bounciness = .5f;
         bool gravity = true;
         bool kinematic = false;
+        bool staticBody = false;
+        bool trigger = false; //overlap events only, see CollisionSolver::getTriggerEvents
+        unsigned layer = 1, mask = 0xFFFFFFFF; //see vRigidBody::canCollide
+        int group = 0;
     };
 
     struct boxPrefab
@@ -54,6 +103,65 @@ public:
         float drag = .5f;
         bool gravity = true;
         bool kinematic = false;
+        bool staticBody = false;
+        bool shapeMatching = false; //one shape matching projection instead of the 28 connections
+        bool trigger = false; //overlap events only, see CollisionSolver::getTriggerEvents
+        unsigned layer = 1, mask = 0xFFFFFFFF; //see vRigidBody::canCollide
+        int group = 0;
+    };
+
+    struct ropePrefab
+    {
+        vec3 from = vec3(.0f, 1.0f, .0f);
+        vec3 to = vec3(1.0f, 1.0f, .0f);
+        int segments = 20;
+        float radius = .02f; //thickness, for the collisions with the rigidbodies
+        float mass = .05f; //of each particle
+        float drag = .5f;
+        bool gravity = true;
+        bool bend = true;
+        bool pinFirst = true;
+        bool pinLast = false;
+        int iterations = 8;
+    };
+
+    struct clothPrefab
+    {
+        vec3 pos = vec3(.0f, 1.0f, .0f); //top left corner
+        vec3 right = vec3(1.0f, .0f, .0f);
+        vec3 down = vec3(.0f, -1.0f, .0f);
+        int width = 16, height = 16; //particles
+        float radius = .02f;
+        float mass = .02f;
+        float drag = .5f;
+        bool gravity = true;
+        bool shear = true;
+        bool bend = true;
+        bool pinTopCorners = true;
+        bool pinTopRow = false;
+        int iterations = 8;
+    };
+
+    //full state of a body as plain data, to move it to another world or to a file
+    struct bodyState
+    {
+        int kind; //0 box, 1 sphere
+        vec3 scale;
+        float mass; //of each particle
+        float drag;
+        float bounciness;
+        bool gravity, kinematic, staticBody, shapeMatching, trigger;
+        unsigned layer, mask;
+        int group;
+        GLfloat color[3];
+        int particles;
+        vec3 now[8], old[8];
+    };
+
+    struct bodyHandle
+    {
+        int id = -1;
+        unsigned generation = 0;
     };
 
     void setWorld(const float &worldSize) 
@@ -65,44 +173,298 @@ public:
 
     vRigidBody* addBox(vec3 pos, GLfloat* color, vec3 rot, vec3 scale, float mass, float drag, bool useGravity, bool isKinematic)
     {
-        m_rBodies.push_back(new Box(this->m_countRb++, pos, color, rot, scale, mass, drag, useGravity, isKinematic, this->m_worldSize));
+        int id = newId();
+        m_rBodies.push_back(new Box(id, pos, color, rot, scale, mass, drag, useGravity, isKinematic, this->m_worldSize));
+        this->m_slots[id].index = m_rBodies.size()-1;
+        if(this->m_rollback) this->m_rollback->invalidate();
         return m_rBodies.back();
     }
 
     vRigidBody* addBox(boxPrefab b)
     {
-        return this->addBox(b.pos, b.color, b.rot, b.scale, b.mass, b.drag, b.gravity, b.kinematic);
+        vRigidBody * rb = this->addBox(b.pos, b.color, b.rot, b.scale, b.mass, b.drag, b.gravity, b.kinematic);
+        if(b.staticBody) this->setStatic(rb, true);
+        rb->setShapeMatching(b.shapeMatching);
+        rb->setTrigger(b.trigger);
+        setFilter(rb, b.layer, b.mask, b.group);
+        return rb;
     }
 
     vRigidBody* addSphere(vec3 pos, GLfloat* color, vec3 rot, const float &radius, float mass, float drag, float bounciness, bool useGravity, bool isKinematic)
     {
-       m_rBodies.push_back(new Sphere(this->m_countRb++, pos, color, rot, radius, mass, drag, bounciness, useGravity, isKinematic, this->m_worldSize));
+       int id = newId();
+       m_rBodies.push_back(new Sphere(id, pos, color, rot, radius, mass, drag, bounciness, useGravity, isKinematic, this->m_worldSize));
+       this->m_slots[id].index = m_rBodies.size()-1;
+       if(this->m_rollback) this->m_rollback->invalidate();
        return m_rBodies.back();
     }
 
     vRigidBody* addSphere(spherePrefab s)
     {
-        return this->addSphere(s.pos, s.color, s.rot, s.radius, s.mass, s.drag, s.bounciness, s.gravity, s.kinematic);
+        vRigidBody * rb = this->addSphere(s.pos, s.color, s.rot, s.radius, s.mass, s.drag, s.bounciness, s.gravity, s.kinematic);
+        if(s.staticBody) this->setStatic(rb, true);
+        rb->setTrigger(s.trigger);
+        setFilter(rb, s.layer, s.mask, s.group);
+        return rb;
+    }
+
+    //static bodies are never integrated and live in a separate tree built once
+    void setStatic(vRigidBody * rb, bool isStatic)
+    {
+        rb->setStatic(isStatic);
+        if(COLLISION_SOLVER) this->m_colSolv->markStaticDirty();
+    }
+
+    //create all the boxes at once: storage is reserved a single time (the particles and the
+    //connections of all the boxes are in one array each, see vMemoryBlock) and the bodies are
+    //built in parallel. returns the index of the first new body, the boxes are stored in the
+    //same order of the prefabs
+    int addBoxes(const vector<boxPrefab> &prefabs)
+    {
+        int first = this->m_rBodies.size();
+        vector<int> id = newIds(prefabs.size(), first);
+        float ws = this->m_worldSize;
+
+        vMemoryBlock * particles = vMemoryBlock::create(MEMORY_PARTICLES, prefabs.size() * 8 * sizeof(vParticle));
+        vMemoryBlock * connections = vMemoryBlock::create(MEMORY_CONNECTIONS, prefabs.size() * Box::CONNECTIONS * sizeof(vConnection));
+
+        this->m_rBodies.resize(first + prefabs.size());
+        vThreadPool::global().parallelFor(prefabs.size(), [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++)
+            {
+                const boxPrefab &b = prefabs[i];
+                this->m_rBodies[first+i] = new Box(id[i], b.pos, b.color, b.rot, b.scale, b.mass, b.drag, b.gravity, b.kinematic, ws, particles, connections);
+                this->m_rBodies[first+i]->setStatic(b.staticBody);
+                this->m_rBodies[first+i]->setShapeMatching(b.shapeMatching);
+                this->m_rBodies[first+i]->setTrigger(b.trigger);
+                setFilter(this->m_rBodies[first+i], b.layer, b.mask, b.group);
+            }
+        });
+
+        //the boxes hold the blocks now
+        particles->release();
+        connections->release();
+
+        if(this->m_rollback) this->m_rollback->invalidate();
+        return first;
+    }
+
+    //same as addBoxes for spheres
+    int addSpheres(const vector<spherePrefab> &prefabs)
+    {
+        int first = this->m_rBodies.size();
+        vector<int> id = newIds(prefabs.size(), first);
+        float ws = this->m_worldSize;
+
+        vMemoryBlock * particles = vMemoryBlock::create(MEMORY_PARTICLES, prefabs.size() * sizeof(vParticle));
+
+        this->m_rBodies.resize(first + prefabs.size());
+        vThreadPool::global().parallelFor(prefabs.size(), [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++)
+            {
+                const spherePrefab &s = prefabs[i];
+                this->m_rBodies[first+i] = new Sphere(id[i], s.pos, s.color, s.rot, s.radius, s.mass, s.drag, s.bounciness, s.gravity, s.kinematic, ws, particles);
+                this->m_rBodies[first+i]->setStatic(s.staticBody);
+                this->m_rBodies[first+i]->setTrigger(s.trigger);
+                setFilter(this->m_rBodies[first+i], s.layer, s.mask, s.group);
+            }
+        });
+
+        particles->release();
+
+        if(this->m_rollback) this->m_rollback->invalidate();
+        return first;
+    }
+
+    //remove a single body in O(1): the last body takes its place in m_rBodies
+    //and its id is recycled. returns false if the handle is stale
+    bool removeBody(bodyHandle h)
+    {
+        vRigidBody * rb = this->getBody(h);
+        if(rb == NULL) return false;
+
+        int index = this->m_slots[h.id].index;
+        vRigidBody * last = this->m_rBodies.back();
+        this->m_rBodies[index] = last;
+        this->m_slots[last->getId()].index = index;
+        this->m_rBodies.pop_back();
+
+        //the broad phase drops its references instead of rebuilding
+        if(COLLISION_SOLVER) this->m_colSolv->removeBody(rb);
+        if(this->m_rollback) this->m_rollback->invalidate();
+
+        this->m_slots[h.id].index = -1;
+        this->m_slots[h.id].generation++;
+        this->m_freeIds.push_back(h.id);
+
+        delete rb;
+        return true;
+    }
+
+    bool removeBody(vRigidBody * rb)
+    {
+        return this->removeBody(this->getHandle(rb));
+    }
+
+    bodyHandle getHandle(vRigidBody * rb)
+    {
+        bodyHandle h;
+        if(rb == NULL) return h;
+        h.id = rb->getId();
+        h.generation = this->m_slots[h.id].generation;
+        return h;
+    }
+
+    //NULL if the body has been removed
+    vRigidBody* getBody(bodyHandle h)
+    {
+        if(h.id < 0 || h.id >= this->m_slots.size()) return NULL;
+        const slot &s = this->m_slots[h.id];
+        if(s.generation != h.generation || s.index < 0) return NULL;
+        return this->m_rBodies[s.index];
+    }
+
+    //emitter of bare particles (debris, sand, ...) stepped with the world after the rigidbodies
+    vParticleSystem* addParticleSystem()
+    {
+        this->m_particleSystems.push_back(new vParticleSystem(this->m_worldSize));
+        return this->m_particleSystems.back();
+    }
+
+    bool removeParticleSystem(vParticleSystem * ps)
+    {
+        vector<vParticleSystem*>::iterator it = std::find(this->m_particleSystems.begin(), this->m_particleSystems.end(), ps);
+        if(it == this->m_particleSystems.end()) return false;
+        this->m_particleSystems.erase(it);
+        delete ps;
+        return true;
+    }
+
+    vector<vParticleSystem*>* getParticleSystems()
+    {
+        return &m_particleSystems;
+    }
+
+    vSoftBody* addRope(ropePrefab r)
+    {
+        vRope * rope = new vRope(r.from, r.to, r.segments, r.radius, r.mass, r.drag, r.gravity, r.bend, this->m_worldSize);
+        rope->iterations = r.iterations;
+        if(r.pinFirst) rope->pin(0);
+        if(r.pinLast) rope->pin(rope->size()-1);
+        this->m_softBodies.push_back(rope);
+        return rope;
+    }
+
+    vSoftBody* addCloth(clothPrefab c)
+    {
+        vCloth * cloth = new vCloth(c.pos, c.right, c.down, c.width, c.height, c.radius, c.mass, c.drag, c.gravity, c.shear, c.bend, this->m_worldSize);
+        cloth->iterations = c.iterations;
+        for(int x = 0; x < cloth->getWidth(); x++)
+            if(c.pinTopRow || (c.pinTopCorners && (x == 0 || x == cloth->getWidth()-1))) cloth->pin(cloth->getIndex(x, 0));
+        this->m_softBodies.push_back(cloth);
+        return cloth;
+    }
+
+    bool removeSoftBody(vSoftBody * sb)
+    {
+        vector<vSoftBody*>::iterator it = std::find(this->m_softBodies.begin(), this->m_softBodies.end(), sb);
+        if(it == this->m_softBodies.end()) return false;
+        this->m_softBodies.erase(it);
+        delete sb;
+        return true;
+    }
+
+    vector<vSoftBody*>* getSoftBodies()
+    {
+        return &m_softBodies;
+    }
+
+    void exportBody(vRigidBody * rb, bodyState &s)
+    {
+        vParticle &p = rb->getParticles()->at(0);
+        s.kind = rb->isBox() ? 0 : 1;
+        s.scale = rb->getSize();
+        s.mass = p.getMass();
+        s.drag = p.getDrag();
+        s.bounciness = rb->isSphere() ? p.getBounciness() : .0f;
+        s.gravity = p.hasGravity();
+        s.kinematic = rb->isKinematic();
+        s.staticBody = rb->isStatic();
+        s.shapeMatching = rb->isShapeMatching();
+        s.trigger = rb->isTrigger();
+        s.layer = rb->getLayer();
+        s.mask = rb->getMask();
+        s.group = rb->getGroup();
+        for(int i = 0; i < 3; i++) s.color[i] = rb->getColor()[i];
+        s.particles = rb->getParticles()->size();
+        for(int i = 0; i < s.particles; i++)
+        {
+            s.now[i] = rb->getParticles()->at(i).getPosition();
+            s.old[i] = rb->getParticles()->at(i).getLastPosition();
+        }
+    }
+
+    //recreate an exported body moved by 'offset' (same particles state, new id)
+    vRigidBody* importBody(const bodyState &s, vec3 offset = vec3(.0f, .0f, .0f))
+    {
+        vec3 center(.0f, .0f, .0f);
+        for(int i = 0; i < s.particles; i++) center += s.now[i];
+        center = center / (float)s.particles + offset;
+
+        GLfloat color[3] = { s.color[0], s.color[1], s.color[2] };
+        vRigidBody * rb = s.kind == 0 ?
+            this->addBox(center, color, vec3(.0f, .0f, .0f), s.scale, s.mass, s.drag, s.gravity, s.kinematic) :
+            this->addSphere(center, color, vec3(.0f, .0f, .0f), s.scale.x, s.mass, s.drag, s.bounciness, s.gravity, s.kinematic);
+
+        //the rest shape comes from the constructor, the pose from the particles
+        for(int i = 0; i < s.particles; i++) rb->getParticles()->at(i).setPosition(s.now[i] + offset, s.old[i] + offset);
+        if(s.staticBody) this->setStatic(rb, true);
+        rb->setShapeMatching(s.shapeMatching);
+        rb->setTrigger(s.trigger);
+        setFilter(rb, s.layer, s.mask, s.group);
+        return rb;
     }
 
     void cleanWorld()
     {
         //call the decostructor of each obj
+        for(int i = 0; i < this->m_rBodies.size(); i++) delete this->m_rBodies[i];
         this->m_rBodies.clear();
 
         this->m_countRb = 0;
+        vector<slot>().swap(this->m_slots);
+        vector<int>().swap(this->m_freeIds);
 
         //make sure mem clear
         vector<vRigidBody*>().swap(this->m_rBodies);
 
         if(COLLISION_SOLVER) this->m_colSolv->clean();
+
+        for(int i = 0; i < this->m_particleSystems.size(); i++) delete this->m_particleSystems[i];
+        vector<vParticleSystem*>().swap(this->m_particleSystems);
+
+        for(int i = 0; i < this->m_softBodies.size(); i++) delete this->m_softBodies[i];
+        vector<vSoftBody*>().swap(this->m_softBodies);
+
+        if(this->m_rollback) this->m_rollback->invalidate();
     }
 
     void step(float dt)
     {      
+        applyCommands(dt);
+
+        if(this->m_reorderInterval > 0 && this->m_frame % this->m_reorderInterval == 0) reorderBodies();
+
+        bool lod = !this->m_observers.empty();
         for(int i = 0; i < this->m_rBodies.size(); i ++)
         {
-            this->m_rBodies.at(i)->update(dt);
+            //kinematic and static bodies are moved only by the user
+            if(!this->m_rBodies.at(i)->isDynamic()) continue;
+            float bodyDt = dt;
+            if((lod || this->m_rBodies.at(i)->getLod().coarse) && !lodStep(this->m_rBodies.at(i), dt, bodyDt)) continue;
+            this->m_rBodies.at(i)->update(bodyDt);
             this->m_rBodies.at(i)->updateConstraint();
         }
 
@@ -112,6 +474,328 @@ public:
             m_colSolv->update();
 
         }
+
+        //particles bounce on the bodies in their final position
+        for(int i = 0; i < this->m_particleSystems.size(); i++) this->m_particleSystems[i]->step(dt, &this->m_rBodies);
+
+        //one soft body per task, the colour batches of a body run inline in its task
+        vThreadPool::global().parallelFor(this->m_softBodies.size(), [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++) this->m_softBodies[i]->step(dt, &this->m_rBodies);
+        }, 1);
+
+        this->m_frame++;
+        if(this->m_rollback) this->m_rollback->save(this->m_frame, this->m_rBodies);
+        if(this->m_rollback && COLLISION_SOLVER) this->m_colSolv->saveHistory(this->m_frame);
+
+        updateTransforms();
+        if(this->m_publisher) publishState();
+        vMemory::global().endStep();
+    }
+
+    //COMMANDS
+    //safe from any thread, also while a step is running: the commands are queued without
+    //locks and applied at the beginning of the next step, before the integration.
+    //the commands on the same body are merged (forces and impulses summed, last teleport wins,
+    //despawn wins over everything). they return false if the queue is full
+
+    bool spawnBox(boxPrefab b, long long tag = 0)
+    {
+        command c;
+        c.type = command::SPAWN_BOX;
+        c.box = b;
+        c.tag = tag;
+        for(int i = 0; i < 3; i++) c.color[i] = b.color ? b.color[i] : 1.0f;
+        return this->commands()->push(c);
+    }
+
+    bool spawnSphere(spherePrefab s, long long tag = 0)
+    {
+        command c;
+        c.type = command::SPAWN_SPHERE;
+        c.sphere = s;
+        c.tag = tag;
+        for(int i = 0; i < 3; i++) c.color[i] = s.color ? s.color[i] : 1.0f;
+        return this->commands()->push(c);
+    }
+
+    bool despawn(bodyHandle h)
+    {
+        return this->pushCommand(command::DESPAWN, h, vec3(.0f, .0f, .0f));
+    }
+
+    //force applied during the next step
+    bool addForce(bodyHandle h, vec3 f)
+    {
+        return this->pushCommand(command::FORCE, h, f);
+    }
+
+    //instant change of momentum
+    bool addImpulse(bodyHandle h, vec3 j)
+    {
+        return this->pushCommand(command::IMPULSE, h, j);
+    }
+
+    //move the center of the body to 'pos' keeping its velocity
+    bool teleport(bodyHandle h, vec3 pos)
+    {
+        return this->pushCommand(command::TELEPORT, h, pos);
+    }
+
+    //bodies created by the commands of the last step: (tag, handle)
+    vector<std::pair<long long, bodyHandle>>* getSpawned()
+    {
+        return &this->m_spawned;
+    }
+
+    //size of the queue, to be called before any command is pushed
+    void setCommandCapacity(int capacity)
+    {
+        this->m_commandCapacity = capacity;
+    }
+
+    //write the transforms (TRANSFORM_POS_QUAT if no format is set) and the contacts of every
+    //step in the shared memory ring 'name', read by other processes with vStateReader.
+    //bodies and contacts past the maximums are not published
+    bool enablePublishing(const std::string &name, int maxBodies, int maxContacts = 1024, int slots = 4)
+    {
+        delete this->m_publisher;
+        this->m_publisher = new vStatePublisher(name, maxBodies, maxContacts, slots);
+        if(!this->m_publisher->isOpen())
+        {
+            this->disablePublishing();
+            return false;
+        }
+        if(this->m_transformFormat == TRANSFORM_NONE) this->setTransformOutput(TRANSFORM_POS_QUAT);
+        return true;
+    }
+
+    void disablePublishing()
+    {
+        delete this->m_publisher;
+        this->m_publisher = NULL;
+    }
+
+    enum TransformFormat
+    {
+        TRANSFORM_NONE,     //nothing is written
+        TRANSFORM_MAT4,     //16 floats per body: column major world matrix, translation * rotation * scale
+        TRANSFORM_POS_QUAT  //8 floats per body: position xyz + 1, rotation quaternion xyzw
+    };
+
+    //at the end of every step the transforms of all the bodies are written, in the order
+    //of getRigidBodies(), in one packed array that can be copied as is in an instance buffer
+    void setTransformOutput(TransformFormat format)
+    {
+        this->m_transformFormat = format;
+        if(format == TRANSFORM_NONE) vector<float>().swap(this->m_transforms);
+        updateTransforms();
+    }
+
+    //also to be called after adding, removing or moving bodies outside step
+    void updateTransforms()
+    {
+        if(this->m_transformFormat == TRANSFORM_NONE) return;
+
+        int stride = this->getTransformStride();
+        this->m_transforms.resize(this->m_rBodies.size() * stride);
+
+        vThreadPool::global().parallelFor(this->m_rBodies.size(), [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++)
+            {
+                vRigidBody * rb = this->m_rBodies[i];
+                float * t = &this->m_transforms[i * stride];
+                vec3 p = rb->getCenter();
+                vec3 x, y, z;
+                rb->getAxes(x, y, z);
+
+                if(this->m_transformFormat == TRANSFORM_MAT4)
+                {
+                    vec3 s = rb->getSize();
+                    t[0] = x.x*s.x;  t[1] = x.y*s.x;  t[2] = x.z*s.x;  t[3] = .0f;
+                    t[4] = y.x*s.y;  t[5] = y.y*s.y;  t[6] = y.z*s.y;  t[7] = .0f;
+                    t[8] = z.x*s.z;  t[9] = z.y*s.z;  t[10] = z.z*s.z; t[11] = .0f;
+                    t[12] = p.x;     t[13] = p.y;     t[14] = p.z;     t[15] = 1.0f;
+                }
+                else
+                {
+                    t[0] = p.x; t[1] = p.y; t[2] = p.z; t[3] = 1.0f;
+                    toQuaternion(x, y, z, &t[4]);
+                }
+            }
+        }, 1024);
+    }
+
+    //NULL until an output format is set
+    const float* getTransforms()
+    {
+        return this->m_transforms.empty() ? NULL : this->m_transforms.data();
+    }
+
+    //floats per body
+    int getTransformStride()
+    {
+        if(this->m_transformFormat == TRANSFORM_MAT4) return 16;
+        if(this->m_transformFormat == TRANSFORM_POS_QUAT) return 8;
+        return 0;
+    }
+
+    int getTransformCount()
+    {
+        int stride = this->getTransformStride();
+        return stride == 0 ? 0 : this->m_transforms.size() / stride;
+    }
+
+    //keep the last 'frames' states to roll back and re-simulate them.
+    //with determinismCheck each saved frame is hashed and compared with the
+    //hash of the same frame from the previous simulation (see vRollback::getMismatches)
+    //adding or removing bodies drops the history.
+    //only the rigidbodies are saved: false while the world has particle systems or soft bodies
+    bool enableRollback(int frames, bool determinismCheck = false)
+    {
+        if(!canRollback()) return false;
+        delete this->m_rollback;
+        this->m_rollback = new vRollback(frames, determinismCheck);
+        this->m_rollback->save(this->m_frame, this->m_rBodies);
+        //the contact cache is part of the state: resting pairs reuse their last solution
+        if(COLLISION_SOLVER)
+        {
+            this->m_colSolv->setHistory(this->m_rollback->getCapacity()+1);
+            this->m_colSolv->saveHistory(this->m_frame);
+        }
+        return true;
+    }
+
+    void disableRollback()
+    {
+        delete this->m_rollback;
+        this->m_rollback = NULL;
+        if(COLLISION_SOLVER) this->m_colSolv->setHistory(0);
+    }
+
+    //restore the rigidbodies to the state they had at the end of step number 'frame'.
+    //false if the frame is not saved anymore, or if particle systems or soft bodies have been
+    //added since enableRollback (they would stay in the future)
+    bool rollback(int frame)
+    {
+        if(!this->m_rollback || !canRollback() || !this->m_rollback->restore(frame)) return false;
+        this->m_frame = frame;
+        //contacts and pairs as they were at the end of the frame
+        if(COLLISION_SOLVER) this->m_colSolv->restoreHistory(frame);
+        updateTransforms();
+        return true;
+    }
+
+    vRollback* getRollback()
+    {
+        return this->m_rollback;
+    }
+
+    //the particle systems and the soft bodies are not part of the saved state
+    bool canRollback()
+    {
+        if(this->m_particleSystems.empty() && this->m_softBodies.empty()) return true;
+        std::cout << "verlet physics -> no rollback with particle systems or soft bodies" << std::endl;
+        return false;
+    }
+
+    int getFrame()
+    {
+        return this->m_frame;
+    }
+
+    //LEVEL OF DETAIL
+    //bodies far from every observer (players, cameras) are integrated every 2nd, 4th or 8th
+    //step with a dt that covers the skipped steps. they stay in the broad phase at their last
+    //position. bodies with the same rate are staggered over the steps by id. no observers = off
+    void setObservers(const vector<vec3> &observers)
+    {
+        //the steps skipped while the lod was off don't count
+        if(this->m_observers.empty())
+            for(int i = 0; i < this->m_rBodies.size(); i++) this->m_rBodies[i]->getLod().frame = -1;
+        this->m_observers = observers;
+    }
+
+    //distance from the closest observer where the rate becomes 2, 4 and 8. a body moves
+    //one band per integration, and only 'hysteresis' (fraction of the distance) past the border
+    void setLodBands(float rate2, float rate4, float rate8, float hysteresis = .1f)
+    {
+        this->m_lodBands[0] = rate2;
+        this->m_lodBands[1] = rate4;
+        this->m_lodBands[2] = rate8;
+        this->m_lodHysteresis = hysteresis;
+    }
+
+    //sort the bodies along a Morton (Z-order) curve every 'steps' steps, so that bodies close
+    //in space are close in m_rBodies and in memory. 0 disables it
+    void setReorderInterval(int steps)
+    {
+        this->m_reorderInterval = steps;
+    }
+
+    int getReorderInterval() { return this->m_reorderInterval; }
+
+    void reorderBodies()
+    {
+        int n = this->m_rBodies.size();
+        if(n < 2) return;
+
+        float inv = 1.0f / (2.0f*this->m_worldSize);
+        vec3 origin(-this->m_worldSize, -this->m_worldSize, -this->m_worldSize);
+        vector<std::pair<unsigned int, int>> keys(n);
+        for(int i = 0; i < n; i++)
+            keys[i] = std::make_pair(morton3D((this->m_rBodies[i]->getPosition() - origin) * inv), i);
+        std::sort(keys.begin(), keys.end());
+
+        vector<vRigidBody*> sorted(n);
+        for(int i = 0; i < n; i++)
+        {
+            sorted[i] = this->m_rBodies[keys[i].second];
+            this->m_slots[sorted[i]->getId()].index = i;
+        }
+        this->m_rBodies.swap(sorted);
+
+        //particles are moved in the new order
+        packBodies();
+    }
+
+    //bytes of particles and connections of all the bodies, to size the blocks of packBodies
+    void getStorage(size_t &particles, size_t &connections)
+    {
+        particles = connections = 0;
+        for(int i = 0; i < this->m_rBodies.size(); i++)
+        {
+            particles += this->m_rBodies[i]->getParticles()->size() * sizeof(vParticle);
+            connections += this->m_rBodies[i]->getConnections()->size() * sizeof(vConnection);
+        }
+    }
+
+    //move the particles of all the bodies in a single array, and their connections in another, in the
+    //order of m_rBodies. without blocks they are made for this world, else they may be shared with
+    //other worlds (see vPhysicsBatch). the old arrays are freed when no body uses them anymore
+    void packBodies(vMemoryBlock * particles = NULL, vMemoryBlock * connections = NULL)
+    {
+        bool own = particles == NULL;
+        if(own)
+        {
+            size_t p, c;
+            getStorage(p, c);
+            particles = vMemoryBlock::create(MEMORY_PARTICLES, p);
+            connections = vMemoryBlock::create(MEMORY_CONNECTIONS, c);
+        }
+
+        for(int i = 0; i < this->m_rBodies.size(); i++) this->m_rBodies[i]->relocateParticles(particles, connections);
+
+        //the bodies hold the blocks now
+        if(own)
+        {
+            particles->release();
+            connections->release();
+        }
+
+        if(COLLISION_SOLVER) this->m_colSolv->relocateBodies();
+        if(this->m_rollback) this->m_rollback->relocate();
     }
 
     vector<vRigidBody*>* getRigidBodies()
@@ -119,6 +803,24 @@ public:
         return &m_rBodies;
     }
 
+    //begin / persist / end of the contacts in the last step (CollisionSolver::contactEvents)
+    vector<CollisionSolver::contactEvent>* getContactEvents()
+    {
+        return this->m_colSolv->getContactEvents();
+    }
+
+    //trigger bodies entered / left in the last step
+    vector<CollisionSolver::triggerEvent>* getTriggerEvents()
+    {
+        return this->m_colSolv->getTriggerEvents();
+    }
+
+    //to change the solver settings (broad phase, contacts cache, ...)
+    CollisionSolver* getCollisionSolver()
+    {
+        return this->m_colSolv;
+    }
+
     //debug
     void getOctreeNodes(vector<std::pair<vec3, vec3>> &result)
     {
@@ -131,4 +833,280 @@ public:
         });
     }
 
+private:
+    vector<vec3> m_observers;
+    float m_lodBands[3] = { 20.0f, 40.0f, 80.0f };
+    float m_lodHysteresis = .1f;
+
+    //false if the body skips this step, otherwise its dt covers the steps since its last integration
+    bool lodStep(vRigidBody * rb, float dt, float &bodyDt)
+    {
+        vRigidBody::lodState &l = rb->getLod();
+        int rate = this->m_observers.empty() ? 1 : l.rate;
+        //never integrated, or integrated in a frame that has been rolled back
+        int elapsed = l.frame < 0 || l.frame >= this->m_frame ? 1 : this->m_frame - l.frame;
+        if(elapsed < rate && (this->m_frame + rb->getId()) % rate != 0) return false;
+
+        bodyDt = dt * elapsed;
+        float last = rb->getParticles()->at(0).getDt();
+        if((elapsed > 1 || l.coarse) && last > .0f && last != bodyDt) rb->rescaleVelocity(bodyDt / last);
+
+        l.frame = this->m_frame;
+        l.coarse = elapsed > 1;
+        if(!this->m_observers.empty()) l.rate = lodRate(rb, l.rate);
+        return true;
+    }
+
+    //one band up or down from the current rate
+    int lodRate(vRigidBody * rb, int rate)
+    {
+        vec3 p = rb->getPosition();
+        float d2 = FLT_MAX;
+        for(int i = 0; i < this->m_observers.size(); i++)
+        {
+            vec3 v = p - this->m_observers[i];
+            d2 = std::min(d2, glm::dot(v, v));
+        }
+
+        int level = rate >= 8 ? 3 : rate >= 4 ? 2 : rate >= 2 ? 1 : 0;
+        float up = level < 3 ? this->m_lodBands[level] * (1.0f + this->m_lodHysteresis) : FLT_MAX;
+        float down = level > 0 ? this->m_lodBands[level-1] * (1.0f - this->m_lodHysteresis) : .0f;
+        if(level < 3 && d2 > up*up) level++;
+        else if(level > 0 && d2 < down*down) level--;
+        return 1 << level;
+    }
+
+    static void setFilter(vRigidBody * rb, unsigned layer, unsigned mask, int group)
+    {
+        rb->setLayer(layer);
+        rb->setMask(mask);
+        rb->setGroup(group);
+    }
+
+    TransformFormat m_transformFormat = TRANSFORM_NONE;
+    vector<float> m_transforms;
+
+    struct command
+    {
+        enum Type { SPAWN_BOX, SPAWN_SPHERE, DESPAWN, FORCE, IMPULSE, TELEPORT } type;
+        bodyHandle body;
+        vec3 value;
+        long long tag;
+        boxPrefab box;
+        spherePrefab sphere;
+        GLfloat color[3]; //the prefab color may be gone when the command is applied
+    };
+
+    //the commands of one step on the same body
+    struct merged
+    {
+        bodyHandle body;
+        vec3 force, impulse, teleport;
+        bool hasForce, hasImpulse, hasTeleport, despawn;
+    };
+
+    //allocated by the first command, most worlds never use it
+    std::atomic<vMpmcQueue<command>*> m_commands{NULL};
+    int m_commandCapacity = 1 << 14;
+    vector<command> m_spawns;
+    vector<merged> m_merged;
+    vector<int> m_mergedIndex; //body id -> m_merged, -1 if none
+    vector<std::pair<long long, bodyHandle>> m_spawned;
+
+    vMpmcQueue<command>* commands()
+    {
+        vMpmcQueue<command> * q = this->m_commands.load(std::memory_order_acquire);
+        if(q) return q;
+        vMpmcQueue<command> * created = new vMpmcQueue<command>(this->m_commandCapacity);
+        if(this->m_commands.compare_exchange_strong(q, created, std::memory_order_acq_rel)) return created;
+        delete created; //another thread was faster
+        return q;
+    }
+
+    bool pushCommand(command::Type type, bodyHandle h, vec3 value)
+    {
+        command c;
+        c.type = type;
+        c.body = h;
+        c.value = value;
+        return this->commands()->push(c);
+    }
+
+    void applyCommands(float dt)
+    {
+        this->m_spawned.clear();
+        vMpmcQueue<command> * q = this->m_commands.load(std::memory_order_acquire);
+        if(q == NULL) return;
+
+        //no more than a queue of commands per step, the producers don't stop while we drain
+        command c;
+        this->m_mergedIndex.resize(this->m_slots.size(), -1);
+        for(size_t n = 0; n < q->capacity() && q->pop(c); n++)
+        {
+            if(c.type == command::SPAWN_BOX || c.type == command::SPAWN_SPHERE)
+            {
+                this->m_spawns.push_back(c);
+                continue;
+            }
+            if(this->getBody(c.body) == NULL) continue; //stale handle
+
+            int &index = this->m_mergedIndex[c.body.id];
+            if(index < 0)
+            {
+                index = this->m_merged.size();
+                merged m;
+                m.body = c.body;
+                m.force = m.impulse = vec3(.0f, .0f, .0f);
+                m.hasForce = m.hasImpulse = m.hasTeleport = m.despawn = false;
+                this->m_merged.push_back(m);
+            }
+            merged &m = this->m_merged[index];
+            if(c.type == command::DESPAWN) m.despawn = true;
+            if(c.type == command::FORCE) { m.force += c.value; m.hasForce = true; }
+            if(c.type == command::IMPULSE) { m.impulse += c.value; m.hasImpulse = true; }
+            if(c.type == command::TELEPORT) { m.teleport = c.value; m.hasTeleport = true; }
+        }
+
+        for(int i = 0; i < this->m_merged.size(); i++)
+        {
+            merged &m = this->m_merged[i];
+            this->m_mergedIndex[m.body.id] = -1;
+            vRigidBody * rb = this->getBody(m.body);
+
+            if(m.despawn) { this->removeBody(m.body); continue; }
+
+            if(m.hasTeleport)
+            {
+                vec3 d = m.teleport - rb->getPosition();
+                for(int k = 0; k < rb->getParticles()->size(); k++)
+                {
+                    vParticle &p = rb->getParticles()->at(k);
+                    p.setPosition(p.getPosition() + d, p.getLastPosition() + d);
+                }
+                if(rb->isStatic() && COLLISION_SOLVER) this->m_colSolv->markStaticDirty();
+            }
+
+            //only dynamic bodies are moved by forces
+            if(!rb->isDynamic()) continue;
+            //applyForce pushes every particle: split the force so that the body gets m.force / getMass()
+            if(m.hasForce) rb->applyForce(m.force / (float)rb->getParticles()->size());
+            if(m.hasImpulse)
+            {
+                vec3 dv = m.impulse / rb->getMass();
+                for(int k = 0; k < rb->getParticles()->size(); k++)
+                {
+                    //the velocity is now - old over the dt of the last integration, larger for bodies on a coarse lod rate
+                    vParticle &p = rb->getParticles()->at(k);
+                    float pdt = p.getDt() > .0f ? p.getDt() : dt;
+                    p.setPosition(p.getPosition(), p.getLastPosition() - dv*pdt);
+                }
+            }
+        }
+        this->m_merged.clear();
+
+        for(int i = 0; i < this->m_spawns.size(); i++)
+        {
+            command &s = this->m_spawns[i];
+            vRigidBody * rb;
+            if(s.type == command::SPAWN_BOX) { s.box.color = s.color; rb = this->addBox(s.box); }
+            else { s.sphere.color = s.color; rb = this->addSphere(s.sphere); }
+            this->m_spawned.push_back(std::make_pair(s.tag, this->getHandle(rb)));
+        }
+        this->m_spawns.clear();
+    }
+
+    vStatePublisher * m_publisher = NULL;
+
+    //one slot of the ring, copied straight from the transforms buffer
+    void publishState()
+    {
+        float * transforms;
+        int32_t * ids;
+        vContactSummary * contacts;
+        this->m_publisher->begin(transforms, ids, contacts);
+
+        int stride = this->getTransformStride();
+        int bodies = std::min(this->getTransformCount(), this->m_publisher->getMaxBodies());
+        if(bodies > 0) std::memcpy(transforms, this->getTransforms(), bodies * stride * sizeof(float));
+        for(int i = 0; i < bodies; i++) ids[i] = this->m_rBodies[i]->getId();
+
+        int count = 0, maxContacts = this->m_publisher->getMaxContacts();
+        if(COLLISION_SOLVER) this->m_colSolv->forEachContact([&](vRigidBody * a, vRigidBody * b, vec3 normal, vec3 point)
+        {
+            if(count >= maxContacts) return;
+            vContactSummary &c = contacts[count++];
+            c.a = a->getId();
+            c.b = b->getId();
+            for(int k = 0; k < 3; k++) { c.normal[k] = normal[k]; c.point[k] = point[k]; }
+        });
+
+        this->m_publisher->commit(this->m_frame, bodies, stride, count);
+    }
+
+    //rotation matrix with columns x y z -> quaternion xyzw
+    static void toQuaternion(vec3 x, vec3 y, vec3 z, float * q)
+    {
+        float trace = x.x + y.y + z.z;
+        if(trace > .0f)
+        {
+            float s = 0.5f / std::sqrt(trace + 1.0f);
+            q[0] = (y.z - z.y) * s;
+            q[1] = (z.x - x.z) * s;
+            q[2] = (x.y - y.x) * s;
+            q[3] = 0.25f / s;
+        }
+        else if(x.x > y.y && x.x > z.z)
+        {
+            float s = 2.0f * std::sqrt(1.0f + x.x - y.y - z.z);
+            q[0] = 0.25f * s;
+            q[1] = (y.x + x.y) / s;
+            q[2] = (z.x + x.z) / s;
+            q[3] = (y.z - z.y) / s;
+        }
+        else if(y.y > z.z)
+        {
+            float s = 2.0f * std::sqrt(1.0f + y.y - x.x - z.z);
+            q[0] = (y.x + x.y) / s;
+            q[1] = 0.25f * s;
+            q[2] = (z.y + y.z) / s;
+            q[3] = (z.x - x.z) / s;
+        }
+        else
+        {
+            float s = 2.0f * std::sqrt(1.0f + z.z - x.x - y.y);
+            q[0] = (z.x + x.z) / s;
+            q[1] = (z.y + y.z) / s;
+            q[2] = 0.25f * s;
+            q[3] = (x.y - y.x) / s;
+        }
+    }
+
+    int newId()
+    {
+        int id;
+        if(!this->m_freeIds.empty())
+        {
+            id = this->m_freeIds.back();
+            this->m_freeIds.pop_back();
+        }
+        else
+        {
+            id = this->m_countRb++;
+            this->m_slots.push_back(slot());
+        }
+        return id;
+    }
+
+    //ids for 'count' bodies that will be stored starting at m_rBodies[first]
+    vector<int> newIds(int count, int first)
+    {
+        vector<int> ids(count);
+        for(int i = 0; i < count; i++)
+        {
+            ids[i] = newId();
+            this->m_slots[ids[i]].index = first+i;
+        }
+        return ids;
+    }
+
 };
\ No newline at end of file
@@ -17,15 +17,21 @@ Real-Time Graphics Programming's Project - 2020/2021
 #include <physics/octree_v1.h>
 #include <physics/verlet/verlet_particle_v1.h>
 #include <physics/verlet/verlet_connection_v1.h>
+#include <physics/memory_v1.h>
 
 #include <vector>
 #include <stdlib.h>
 #include <cmath>
+#include <limits>
 
 class Box;
 class Sphere;
 
-class vRigidBody : public OItem
+//particles and connections of a body, accounted in vMemory
+typedef vector<vParticle, vTaggedAllocator<vParticle, MEMORY_PARTICLES>> vParticleArray;
+typedef vector<vConnection, vTaggedAllocator<vConnection, MEMORY_CONNECTIONS>> vConnectionArray;
+
+class vRigidBody : public OItem, public vTracked<MEMORY_BODIES>
 {
     public:
 
@@ -373,6 +379,16 @@ class vRigidBody : public OItem
             return a;
         }
 
+        //point of the box closest to p, p itself if it is inside
+        static vec3 closestPoint(box b, vec3 p)
+        {
+            vec3 v = p - b.position;
+            float x = max( -b.w, min( glm::dot(v, b.x), b.w ) );
+            float y = max( -b.h, min( glm::dot(v, b.y), b.h ) );
+            float z = max( -b.d, min( glm::dot(v, b.z), b.d ) );
+            return b.position + b.x*x + b.y*y + b.z*z;
+        }
+
         static box createFromAxisAligned(vec3 pos, float side_size)
         {
             return box::create( pos, 
@@ -399,10 +415,11 @@ class vRigidBody : public OItem
             return s; 
         }
 
-        //todo
+        //oriented box: the closest point is found in the box frame
         static bool collide(sphere s, box b, vec3 intersection)
         {
-            return false;
+            vec3 d = box::closestPoint(b, s.pos) - s.pos;
+            return glm::dot(d, d) < s.r*s.r;
         }
 
         static bool collideAxisAligned(sphere s, box b)
@@ -437,13 +454,35 @@ class vRigidBody : public OItem
 
     int m_id;
     int m_kind;
-    bool m_isKinematic;
+    bool m_isKinematic; //moved only by the user, pushes the other bodies
+    bool m_isStatic = false; //never moves
+    bool m_isTrigger = false; //only reports the overlaps, never moves nor pushes
+    bool m_isGhost = false; //copy of a body simulated by another shard: pushes with its mass, never moves by itself
+
+    //collision filter: two bodies meet if each one's layer is in the other's mask
+    //and they are not in the same group (0 = no group)
+    unsigned m_layer = 1;
+    unsigned m_mask = 0xFFFFFFFF;
+    int m_group = 0;
+
+public:
+    //level of detail, managed by vPhysics (see setObservers)
+    struct lodState
+    {
+        int rate = 1;           //integrated every 'rate' steps
+        int frame = -1;         //step of the last integration
+        bool coarse = false;    //the last integration covered more than one step
+    };
+
+protected:
+    lodState m_lod;
+    bool m_shapeMatching = false; //rigidity restored by shape matching instead of the connections
 
     vec3 m_start_pos;
     vec3 m_start_rot;
 
-    vector<vParticle> m_particles;
-    vector<vConnection> m_connections;
+    vParticleArray m_particles;
+    vConnectionArray m_connections;
 
 public:
 
@@ -451,7 +490,9 @@ public:
     
     vRigidBody& operator=(const vRigidBody& copy) = delete;
 
-    vRigidBody(const int id,const int kind, GLfloat* color, const vec3 scale, const bool isKinematic)
+    //the particles and the connections are taken from the blocks if given (see vMemoryBlock)
+    vRigidBody(const int id,const int kind, GLfloat* color, const vec3 scale, const bool isKinematic, vMemoryBlock * particles = NULL, vMemoryBlock * connections = NULL)
+    : m_particles(vParticleArray::allocator_type(particles)), m_connections(vConnectionArray::allocator_type(connections))
     {
         this->m_scale = scale;
         this->m_isKinematic = isKinematic;
@@ -471,6 +512,8 @@ public:
     void updateConstraint()
     {
         if(this->m_kind == 1) return;
+
+        if(this->m_shapeMatching && this->matchShape()) return;
         
         for(int i = 0; i < 2; i++) for_each(this->m_connections.begin(), this->m_connections.end(), [&](vConnection &c) { c.enforceConstraint(); } );
     }      
@@ -485,9 +528,99 @@ public:
 
     bool isSphere(){ return this->m_kind == 1; }  // 1 for Spheres
 
-    vector<vParticle>* getParticles() { return &this->m_particles; }
+    bool isKinematic(){ return this->m_isKinematic; }
+
+    bool isStatic(){ return this->m_isStatic; }
+
+    bool isTrigger(){ return this->m_isTrigger; }
+
+    bool isGhost(){ return this->m_isGhost; }
+
+    //dynamic bodies are integrated and pushed by collisions, kinematic, static, trigger and ghost ones are not
+    bool isDynamic(){ return !this->m_isKinematic && !this->m_isStatic && !this->m_isTrigger && !this->m_isGhost; }
+
+    void setKinematic(bool kinematic) { this->m_isKinematic = kinematic; }
+
+    void setStatic(bool isStatic) { this->m_isStatic = isStatic; }
+
+    void setTrigger(bool isTrigger) { this->m_isTrigger = isTrigger; }
+
+    //the responses on a ghost are not applied, the collision solver hands them out (see CollisionSolver::getGhostResponses)
+    void setGhost(bool ghost) { this->m_isGhost = ghost; }
+
+    void setLayer(unsigned layer) { this->m_layer = layer; }
+
+    void setMask(unsigned mask) { this->m_mask = mask; }
+
+    void setGroup(int group) { this->m_group = group; }
+
+    unsigned getLayer() { return this->m_layer; }
+
+    unsigned getMask() { return this->m_mask; }
+
+    int getGroup() { return this->m_group; }
+
+    lodState& getLod() { return this->m_lod; }
+
+    //verlet velocity is (now - old) / dt: keep it when the next step is k times longer
+    void rescaleVelocity(float k)
+    {
+        for(int i = 0; i < this->m_particles.size(); i++)
+        {
+            vParticle &p = this->m_particles[i];
+            p.setPosition(p.getPosition(), p.getPosition() - (p.getPosition() - p.getLastPosition())*k);
+        }
+    }
+
+    //checked by the broad phase before any other work on the pair
+    static bool canCollide(const vRigidBody * a, const vRigidBody * b)
+    {
+        return (a->m_layer & b->m_mask) && (b->m_layer & a->m_mask) && (a->m_group == 0 || a->m_group != b->m_group);
+    }
+
+    void setShapeMatching(bool shapeMatching) { this->m_shapeMatching = shapeMatching; }
+
+    bool isShapeMatching() { return this->m_shapeMatching; }
+
+    //project the particles on the rest shape of the body, returns false if it can't be done
+    virtual bool matchShape() { return false; }
+
+    //move the body by the offset between 'pos' and its center. the offset becomes its
+    //velocity, this is how kinematic bodies are driven
+    void moveTo(vec3 pos)
+    {
+        vec3 d = pos - this->getPosition();
+        for(int i = 0; i < this->m_particles.size(); i++)
+            this->m_particles[i].setPosition(this->m_particles[i].getPosition() + d, this->m_particles[i].getPosition());
+    }
+
+    //mass seen by the collision response: non dynamic bodies can't be pushed, ghosts are pushed elsewhere
+    float getEffectiveMass()
+    {
+        return this->isDynamic() || this->m_isGhost ? this->getMass() : std::numeric_limits<float>::infinity();
+    }
+
+    //move the particles and the connections (fixing them up) to the blocks, so that bodies
+    //relocated one after the other are next to each other in a single array
+    void relocateParticles(vMemoryBlock * particles, vMemoryBlock * connections)
+    {
+        if(this->m_particles.empty()) return;
+        vParticleArray moved((vParticleArray::allocator_type(particles)));
+        moved.reserve(this->m_particles.size());
+        moved.insert(moved.end(), this->m_particles.begin(), this->m_particles.end());
+        for(int i = 0; i < this->m_connections.size(); i++)
+            this->m_connections[i].rebind(&this->m_particles[0], &moved[0]);
+        this->m_particles.swap(moved);
+
+        vConnectionArray links((vConnectionArray::allocator_type(connections)));
+        links.reserve(this->m_connections.size());
+        links.insert(links.end(), this->m_connections.begin(), this->m_connections.end());
+        this->m_connections.swap(links);
+    }
+
+    vParticleArray* getParticles() { return &this->m_particles; }
     
-    vector<vConnection>* getConnections() { return &this->m_connections; }
+    vConnectionArray* getConnections() { return &this->m_connections; }
 
     vec3 getSize() { return this->m_scale; }
 
@@ -508,6 +641,22 @@ public:
     virtual vec3 getPosition() = 0;
     
     virtual vec3 getLastPosition() = 0;
+
+    virtual float getMass() = 0;
+
+    //radius of the sphere that bounds the body
+    virtual float getBoundingRadius() { return glm::length(this->m_scale); }
+
+    //axis aligned bounds of the particles
+    virtual void getBounds(vec3 &min, vec3 &max)
+    {
+        min = max = this->m_particles.at(0).getPosition();
+        for(int i = 1; i < this->m_particles.size(); i++)
+        {
+            min = glm::min(min, this->m_particles.at(i).getPosition());
+            max = glm::max(max, this->m_particles.at(i).getPosition());
+        }
+    }
     
     virtual vec3 getXAxis() = 0;
     
@@ -519,6 +668,31 @@ public:
     
     virtual glm::mat4 getRotation() = 0; //return rotation from 0f 0f 0f to actual rotation
 
+    //same axes as getXYZAxis, without virtual calls and allocations (per body loops)
+    void getAxes(vec3 &x, vec3 &y, vec3 &z)
+    {
+        if(this->m_kind == 1)
+        {
+            x = vec3(1.0f,.0f,.0f);
+            y = vec3(.0f,1.0f,.0f);
+            z = vec3(.0f,.0f,1.0f);
+            return;
+        }
+        vec3 v0 = this->m_particles[0].getPosition();
+        vec3 v1 = this->m_particles[1].getPosition();
+        vec3 v2 = this->m_particles[2].getPosition();
+        x = glm::normalize(v0 - v1);
+        y = glm::normalize(glm::cross(x, v2-v0));
+        z = glm::cross(x, y);
+    }
+
+    //same as getPosition, without the virtual call
+    vec3 getCenter()
+    {
+        if(this->m_kind == 1) return this->m_particles[0].getPosition();
+        return (this->m_particles[6].getPosition()+this->m_particles[0].getPosition())*0.5f;
+    }
+
     void setColor(GLfloat* color)
     {
         delete[] m_diffuseColor;
@@ -531,34 +705,103 @@ public:
 
     static bool collide(Sphere* a, Sphere* b, vec3 intersection);
 
+    //boolean test only, any pair of shapes (for the triggers)
+    static bool overlap(vRigidBody* a, vRigidBody* b);
+
 };
 
 class Box : public vRigidBody
 {
     public:
-    Box(int id, vec3 pos, GLfloat* color, vec3 e_rot, vec3 scale, float mass,float drag, bool useGravity,bool isKinematic, float worldSize)
-    : vRigidBody(id, 0, color, scale, isKinematic)
+    //local position (in half sizes) of the 8 particles of a box
+    static const vec3* corners()
     {
-        vector<vec3> obj_pos;
+        static const vec3 c[8] = {
+            vec3( 1.0f,     1.0f,   1.0f    ),
+            vec3( -1.0f,    1.0f,   1.0f    ),
+            vec3( -1.0f,    1.0f,   -1.0f   ),
+            vec3( 1.0f,     1.0f,   -1.0f   ),
+            vec3( 1.0f,     -1.0f,  1.0f    ),
+            vec3( -1.0f,    -1.0f,  1.0f    ),
+            vec3( -1.0f,    -1.0f,  -1.0f   ),
+            vec3( 1.0f,     -1.0f,  -1.0f   )
+        };
+        return c;
+    }
+
+    static const int CONNECTIONS = 28;
+
+    //particles connected by each connection (every pair), shared by all the boxes
+    static const std::pair<int, int>* topology()
+    {
+        //built once, thread safe (boxes can be created in parallel)
+        static const struct table
+        {
+            std::pair<int, int> t[CONNECTIONS];
+            table()
+            {
+                int k = 0;
+                for(int i = 0; i < 7; i ++)
+                    for(int j = i+1; j < 8; j++)
+                        t[k++] = std::make_pair(i, j);
+            }
+        } tab;
+        return tab.t;
+    }
+
+    Box(int id, vec3 pos, GLfloat* color, vec3 e_rot, vec3 scale, float mass,float drag, bool useGravity,bool isKinematic, float worldSize, vMemoryBlock * particles = NULL, vMemoryBlock * connections = NULL)
+    : vRigidBody(id, 0, color, scale, isKinematic, particles, connections)
+    {
+        const vec3 * c = corners();
+        const std::pair<int, int> * t = topology();
 
-        obj_pos.push_back(vec3( scale.x,    scale.y,    scale.z     ));
-        obj_pos.push_back(vec3( -scale.x,   scale.y,    scale.z     ));
-        obj_pos.push_back(vec3( -scale.x,   scale.y,    -scale.z    ));
-        obj_pos.push_back(vec3( scale.x,    scale.y,    -scale.z    ));
-        obj_pos.push_back(vec3( scale.x,    -scale.y,   scale.z     ));
-        obj_pos.push_back(vec3( -scale.x,   -scale.y,   scale.z     ));
-        obj_pos.push_back(vec3( -scale.x,   -scale.y,   -scale.z    ));
-        obj_pos.push_back(vec3( scale.x,    -scale.y,   -scale.z    ));
+        this->m_particles.reserve(8);
+        this->m_connections.reserve(CONNECTIONS);
 
         glm::mat4 rot = glm::eulerAngleYXZ(e_rot.y, e_rot.x, e_rot.z);
         for(int i = 0; i < 8; i++){
-            glm::vec4 p = glm::vec4(obj_pos[i], 1) * rot;
+            glm::vec4 p = glm::vec4(c[i]*scale, 1) * rot;
             this->m_particles.push_back(vParticle(id, i, vec3(pos.x+p.x, pos.y+p.y, pos.z+p.z), mass, drag, worldSize, useGravity));
         }
 
-        for(int i = 0; i < this->m_particles.size()-1; i ++)
-            for(int j = i+1; j < this->m_particles.size(); j++)
-                this->m_connections.push_back(vConnection(&this->m_particles.at( i ),&this->m_particles.at( j )));
+        for(int i = 0; i < CONNECTIONS; i ++)
+            this->m_connections.push_back(vConnection(&this->m_particles.at( t[i].first ),&this->m_particles.at( t[i].second )));
+    }
+
+    //shape matching (Muller et al. 2005): the 8 particles are moved on the rest shape
+    //rotated by the optimal rotation, the rotational part of the polar decomposition of
+    //A = sum (x_i - c) q_i^T, with x_i current positions, c their center, q_i rest positions
+    bool matchShape()
+    {
+        const vec3 * c = corners();
+
+        vec3 center(.0f, .0f, .0f);
+        for(int i = 0; i < 8; i++) center += this->m_particles[i].getPosition();
+        center *= 0.125f;
+
+        glm::mat3 A(0.0f);
+        for(int i = 0; i < 8; i++) A += glm::outerProduct(this->m_particles[i].getPosition() - center, c[i]*this->m_scale);
+
+        //divide by sum q_i q_i^T, diagonal for a box -> A is close to a rotation
+        A[0] /= 8.0f*this->m_scale.x*this->m_scale.x;
+        A[1] /= 8.0f*this->m_scale.y*this->m_scale.y;
+        A[2] /= 8.0f*this->m_scale.z*this->m_scale.z;
+
+        //collapsed or inverted box -> let the connections fix it
+        if(glm::determinant(A) < 1e-4f) return false;
+
+        //polar decomposition by Newton iterations: R = (R + R^-T) / 2
+        glm::mat3 R = A;
+        for(int k = 0; k < 8; k++)
+        {
+            glm::mat3 next = 0.5f*(R + glm::inverse(glm::transpose(R)));
+            float change = glm::length(next[0]-R[0]) + glm::length(next[1]-R[1]) + glm::length(next[2]-R[2]);
+            R = next;
+            if(change < 1e-6f) break;
+        }
+
+        for(int i = 0; i < 8; i++) this->m_particles[i].setPosition(center + R*(c[i]*this->m_scale));
+        return true;
     }
 
     ~Box()
@@ -602,12 +845,8 @@ class Box : public vRigidBody
 
     vector<vec3> getXYZAxis()
     {
-        vec3 v0 = this->m_particles.at(0).getPosition();
-        vec3 v1 = this->m_particles.at(1).getPosition();
-        vec3 v2 = this->m_particles.at(2).getPosition();
-        vec3 x = glm::normalize(v0 - v1);
-        vec3 y = glm::normalize(glm::cross(x, v2-v0));
-        vec3 z = glm::cross(x, y);
+        vec3 x, y, z;
+        this->getAxes(x, y, z);
 
         vector<vec3> v;
         v.push_back(x);
@@ -620,11 +859,12 @@ class Box : public vRigidBody
     {
         glm::mat4 result;
 
-        vector<vec3> axis = this->getXYZAxis();
+        vec3 x, y, z;
+        this->getAxes(x, y, z);
         
-        result[0] = glm::vec4(axis.at(0), 0);
-        result[1] = glm::vec4(axis.at(1), 0);
-        result[2] = glm::vec4(axis.at(2), 0);
+        result[0] = glm::vec4(x, 0);
+        result[1] = glm::vec4(y, 0);
+        result[2] = glm::vec4(z, 0);
         result[3] = glm::vec4(0, 0, 0, 1);
 
         return result;
@@ -657,8 +897,8 @@ class Box : public vRigidBody
 class Sphere : public vRigidBody
 {
     public:
-    Sphere(const int id, const vec3 pos, GLfloat* color, const vec3 e_rot, const float radius,const float mass,const float drag, const float bounciness, const bool useGravity,const bool isKinematic, const float &worldSize)
-    : vRigidBody(id, 1, color, vec3(radius, radius, radius), isKinematic)
+    Sphere(const int id, const vec3 pos, GLfloat* color, const vec3 e_rot, const float radius,const float mass,const float drag, const float bounciness, const bool useGravity,const bool isKinematic, const float &worldSize, vMemoryBlock * particles = NULL)
+    : vRigidBody(id, 1, color, vec3(radius, radius, radius), isKinematic, particles)
     {
         this->m_start_pos = pos;
         this->m_start_rot = e_rot;
@@ -667,6 +907,7 @@ class Sphere : public vRigidBody
 
         glm::vec4 p = glm::vec4(vec3(.0f,.0f,.0f), 1) * rot; //sphere is made up by 1 patricles in its center
 
+        m_particles.reserve(1);
         m_particles.push_back(SphereParticle(id, 0, vec3(pos.x+p.x, pos.y+p.y, pos.z+p.z), radius, mass, drag, bounciness, worldSize, useGravity));
     }
 
@@ -693,6 +934,18 @@ class Sphere : public vRigidBody
         return m_particles.at(0).getRadius();
     }
 
+    float getBoundingRadius()
+    {
+        return this->getRadius();
+    }
+
+    void getBounds(vec3 &min, vec3 &max)
+    {
+        float r = this->getRadius();
+        min = this->getPosition() - vec3(r, r, r);
+        max = this->getPosition() + vec3(r, r, r);
+    }
+
     float getMass()
     {
         return m_particles.at(0).getMass();
@@ -763,6 +1016,15 @@ inline bool vRigidBody::collide(vRigidBody* a, vRigidBody* b, vec3 intersection)
     return false;
 };
 
+inline bool vRigidBody::overlap(vRigidBody* a, vRigidBody* b)
+{
+    vec3 n;
+    if (a->isBox() && b->isBox()) return box::collide(dynamic_cast<Box*>(a)->getBox(), dynamic_cast<Box*>(b)->getBox(), n);
+    if (a->isSphere() && b->isSphere()) return sphere::collide(dynamic_cast<Sphere*>(a)->getSphere(), dynamic_cast<Sphere*>(b)->getSphere(), n);
+    if (a->isBox()) std::swap(a, b);
+    return sphere::collide(dynamic_cast<Sphere*>(a)->getSphere(), dynamic_cast<Box*>(b)->getBox(), n);
+}
+
 inline bool vRigidBody::collide(Box* a, Box* b, vec3 intersection)
 {
     return box::collide(a->getBox(), b->getBox(), intersection);
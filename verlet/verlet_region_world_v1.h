@@ -0,0 +1,600 @@
+/*
+VERLET PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+//Physics class
+#include <physics/verlet/verlet_physics_v1.h>
+#include <physics/thread_pool_v1.h>
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+//Regions paged out to disk: one binary file per region in an existing directory.
+//The file holds the global id and the state of every body of the region.
+class vRegionStore
+{
+    struct header
+    {
+        char magic[4];
+        int version;
+        int count;
+    };
+
+    std::string m_dir;
+
+public:
+    vRegionStore(const std::string &dir)
+    {
+        this->m_dir = dir;
+    }
+
+    std::string path(long long key)
+    {
+        return this->m_dir + "/region_" + std::to_string(key) + ".bin";
+    }
+
+    bool save(long long key, const vector<long long> &ids, const vector<vPhysics::bodyState> &bodies)
+    {
+        FILE * f = fopen(path(key).c_str(), "wb");
+        if(!f)
+        {
+            std::cout << "verlet region store -> can't write " << path(key) << std::endl;
+            return false;
+        }
+        header h = { {'V', 'R', 'G', 'N'}, 3, (int)bodies.size() };
+        bool ok = fwrite(&h, sizeof(header), 1, f) == 1;
+        for(int i = 0; ok && i < bodies.size(); i++)
+            ok = fwrite(&ids[i], sizeof(long long), 1, f) == 1 && fwrite(&bodies[i], sizeof(vPhysics::bodyState), 1, f) == 1;
+        fclose(f);
+        return ok;
+    }
+
+    bool load(long long key, vector<long long> &ids, vector<vPhysics::bodyState> &bodies)
+    {
+        FILE * f = fopen(path(key).c_str(), "rb");
+        if(!f) return false;
+        header h;
+        bool ok = fread(&h, sizeof(header), 1, f) == 1 && h.version == 3 && h.count >= 0;
+        if(ok)
+        {
+            ids.resize(h.count);
+            bodies.resize(h.count);
+            for(int i = 0; ok && i < h.count; i++)
+                ok = fread(&ids[i], sizeof(long long), 1, f) == 1 && fread(&bodies[i], sizeof(vPhysics::bodyState), 1, f) == 1;
+        }
+        fclose(f);
+        if(!ok) std::cout << "verlet region store -> corrupted " << path(key) << std::endl;
+        return ok;
+    }
+
+    void remove(long long key)
+    {
+        std::remove(path(key).c_str());
+    }
+};
+
+//World without bounds split in cubic regions of side 'regionSize', each one a vPhysics with its own
+//broad phase. A region simulates in its own frame (centered on the region), so coordinates never
+//grow with the distance from the origin; the user works relative to an origin region that can be
+//moved (rebase). Only the regions near an anchor (player, camera, ...) are kept in memory and
+//stepped, the others are written to the store and read back when an anchor gets close.
+//Bodies leaving their region after a step migrate to the neighbour one.
+//Bodies closer than 'ghostWidth' to a loaded neighbour region are mirrored there as ghosts
+//(vRigidBody::setGhost, as vShard does), so they collide with the bodies on the other side of the
+//border. A body is mirrored only into the neighbours that come before its region (by x, then y,
+//then z): a pair across a border is resolved once, by the first region, and the responses on
+//the ghost are applied to the body it mirrors. The ghosts are in the worlds of getLoadedRegions too.
+//Static bodies are never mirrored and never migrate: the level geometry has to be split along the regions.
+class vRegionWorld
+{
+public:
+    struct regionHandle
+    {
+        long long id = -1;
+    };
+
+private:
+    struct region
+    {
+        int x, y, z;
+        vPhysics * world = NULL; //NULL when paged out
+        std::unordered_map<int, long long> ids; //body id in the world -> global id
+        std::unordered_map<long long, vPhysics::bodyHandle> ghosts; //global id -> ghost here
+        std::unordered_map<int, long long> ghostIds; //body id in the world -> global id of the mirrored body
+        int count = 0; //bodies, also when paged out (not the ghosts)
+        bool lost = false; //its file can't be read: it stays paged out
+    };
+
+    struct location
+    {
+        long long region;
+        vPhysics::bodyHandle handle; //not valid when the region is paged out
+    };
+
+    float m_regionSize;
+    float m_loadRadius;
+    CollisionSolver::BroadPhase m_broadPhase;
+
+    std::unordered_map<long long, region*> m_regions;
+    std::unordered_map<long long, location> m_bodies; //global id -> where the body is
+    long long m_nextId = 0;
+
+    vRegionStore m_store;
+    vector<vec3> m_anchors; //relative to the origin
+    int m_origin[3] = { 0, 0, 0 };
+
+    vThreadPool * m_pool;
+
+public:
+    //at least the size of the biggest body, at most half a region
+    float ghostWidth = 1.0f;
+
+    //'storeDir' must exist. regions closer than 'loadRadius' to an anchor are loaded,
+    //the ones farther than 1.5 * loadRadius are paged out
+    vRegionWorld(float regionSize, float loadRadius, const std::string &storeDir, CollisionSolver::BroadPhase broadPhase = CollisionSolver::OCTREE, vThreadPool * pool = &vThreadPool::global())
+    : m_store(storeDir)
+    {
+        this->m_regionSize = regionSize;
+        this->m_loadRadius = loadRadius;
+        this->m_broadPhase = broadPhase;
+        this->m_pool = pool;
+    }
+
+    ~vRegionWorld()
+    {
+        for(std::unordered_map<long long, region*>::iterator it = this->m_regions.begin(); it != this->m_regions.end(); ++it)
+        {
+            if(!it->second->world && !it->second->lost) this->m_store.remove(it->first);
+            delete it->second->world;
+            delete it->second;
+        }
+    }
+
+    vRegionWorld(const vRegionWorld&) = delete;
+
+    vRegionWorld& operator=(const vRegionWorld&) = delete;
+
+    //positions of the prefabs are relative to the origin. the handle is not valid (id -1) if the
+    //region can't be loaded
+    regionHandle addBox(vPhysics::boxPrefab b)
+    {
+        region * r = regionAt(b.pos, b.pos);
+        return r ? add(r, r->world->addBox(b)) : regionHandle();
+    }
+
+    regionHandle addSphere(vPhysics::spherePrefab s)
+    {
+        region * r = regionAt(s.pos, s.pos);
+        return r ? add(r, r->world->addSphere(s)) : regionHandle();
+    }
+
+    bool removeBody(regionHandle h)
+    {
+        std::unordered_map<long long, location>::iterator it = this->m_bodies.find(h.id);
+        if(it == this->m_bodies.end()) return false;
+        region * r = pageIn(it->second.region);
+        if(r == NULL) return false;
+        vRigidBody * rb = r->world->getBody(it->second.handle);
+        if(rb == NULL) return false;
+        r->ids.erase(rb->getId());
+        r->world->removeBody(it->second.handle);
+        r->count--;
+        this->m_bodies.erase(it);
+        dropGhosts(h.id);
+        return true;
+    }
+
+    //NULL if the body has been removed or its region is paged out. the body is in the
+    //frame of its region, see getPosition
+    vRigidBody* getBody(regionHandle h)
+    {
+        std::unordered_map<long long, location>::iterator it = this->m_bodies.find(h.id);
+        if(it == this->m_bodies.end()) return NULL;
+        region * r = this->m_regions[it->second.region];
+        return r->world ? r->world->getBody(it->second.handle) : NULL;
+    }
+
+    //position relative to the origin, false if the body is not in memory
+    bool getPosition(regionHandle h, vec3 &pos)
+    {
+        vRigidBody * rb = getBody(h);
+        if(rb == NULL) return false;
+        pos = rb->getPosition() + regionOffset(this->m_regions[this->m_bodies[h.id].region]);
+        return true;
+    }
+
+    void setAnchors(const vector<vec3> &anchors)
+    {
+        this->m_anchors = anchors;
+    }
+
+    //move the origin to the region containing 'pos' (relative to the current origin).
+    //returns the shift to subtract from the positions kept by the user (camera, anchors, ...)
+    vec3 rebase(vec3 pos)
+    {
+        int c[3];
+        cellOf(pos, c);
+        vec3 shift((c[0]-this->m_origin[0])*this->m_regionSize, (c[1]-this->m_origin[1])*this->m_regionSize, (c[2]-this->m_origin[2])*this->m_regionSize);
+        for(int i = 0; i < 3; i++) this->m_origin[i] = c[i];
+        for(int i = 0; i < this->m_anchors.size(); i++) this->m_anchors[i] -= shift;
+        return shift;
+    }
+
+    void step(float dt)
+    {
+        updatePaging();
+
+        vector<region*> loaded;
+        for(std::unordered_map<long long, region*>::iterator it = this->m_regions.begin(); it != this->m_regions.end(); ++it)
+            if(it->second->world) loaded.push_back(it->second);
+
+        //a region per task, vPhysics runs its loops inline
+        updateGhosts(loaded);
+
+        this->m_pool->parallelFor(loaded.size(), [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++) loaded[i]->world->step(dt);
+        }, 1);
+
+        for(int i = 0; i < loaded.size(); i++) pushGhosts(loaded[i]);
+        for(int i = 0; i < loaded.size(); i++) migrate(loaded[i]);
+    }
+
+    //loaded regions and the offset from their frame to the origin, for rendering
+    void getLoadedRegions(vector<vPhysics*> &worlds, vector<vec3> &offsets)
+    {
+        for(std::unordered_map<long long, region*>::iterator it = this->m_regions.begin(); it != this->m_regions.end(); ++it)
+            if(it->second->world)
+            {
+                worlds.push_back(it->second->world);
+                offsets.push_back(regionOffset(it->second));
+            }
+    }
+
+    int getRegionCount() { return this->m_regions.size(); }
+
+    int getLoadedCount()
+    {
+        int n = 0;
+        for(std::unordered_map<long long, region*>::iterator it = this->m_regions.begin(); it != this->m_regions.end(); ++it)
+            if(it->second->world) n++;
+        return n;
+    }
+
+    int getBodyCount() { return this->m_bodies.size(); }
+
+private:
+    //21 bits per coordinate
+    static long long key(int x, int y, int z)
+    {
+        return ((long long)(x & 0x1FFFFF) << 42) | ((long long)(y & 0x1FFFFF) << 21) | (long long)(z & 0x1FFFFF);
+    }
+
+    //absolute region of a position relative to the origin
+    void cellOf(vec3 pos, int c[3])
+    {
+        for(int i = 0; i < 3; i++) c[i] = this->m_origin[i] + (int)std::floor(pos[i] / this->m_regionSize + 0.5f);
+    }
+
+    vec3 regionOffset(region * r)
+    {
+        return vec3((r->x-this->m_origin[0])*this->m_regionSize, (r->y-this->m_origin[1])*this->m_regionSize, (r->z-this->m_origin[2])*this->m_regionSize);
+    }
+
+    //region containing 'pos' (relative to the origin), loaded, NULL if it can't be loaded.
+    //'local' is 'pos' in its frame
+    region* regionAt(vec3 pos, vec3 &local)
+    {
+        int c[3];
+        cellOf(pos, c);
+        region * r = pageIn(key(c[0], c[1], c[2]), c);
+        if(r) local = pos - regionOffset(r);
+        return r;
+    }
+
+    regionHandle add(region * r, vRigidBody * rb)
+    {
+        regionHandle h;
+        h.id = this->m_nextId++;
+        r->ids[rb->getId()] = h.id;
+        r->count++;
+        location l;
+        l.region = key(r->x, r->y, r->z);
+        l.handle = r->world->getHandle(rb);
+        this->m_bodies[h.id] = l;
+        return h;
+    }
+
+    //make sure the region is in memory, creating it if it doesn't exist.
+    //NULL if its file can't be read: the file is kept and the region stays paged out
+    region* pageIn(long long k, const int c[3] = NULL)
+    {
+        region * r;
+        std::unordered_map<long long, region*>::iterator it = this->m_regions.find(k);
+        if(it == this->m_regions.end())
+        {
+            r = new region();
+            r->x = c[0]; r->y = c[1]; r->z = c[2];
+            this->m_regions[k] = r;
+        }
+        else r = it->second;
+        if(r->world) return r;
+        if(r->lost) return NULL;
+
+        //twice the region: bodies cross the border and migrate before hitting the bounds
+        r->world = new vPhysics();
+        r->world->setWorld(this->m_regionSize);
+        r->world->getCollisionSolver()->broadPhase = this->m_broadPhase;
+
+        if(r->count > 0)
+        {
+            vector<long long> ids;
+            vector<vPhysics::bodyState> bodies;
+            if(!this->m_store.load(k, ids, bodies))
+            {
+                std::cout << "verlet region world -> can't load " << this->m_store.path(k) << ", its " << r->count << " bodies stay paged out" << std::endl;
+                delete r->world;
+                r->world = NULL;
+                r->lost = true;
+                return NULL;
+            }
+            for(int i = 0; i < bodies.size(); i++)
+            {
+                vRigidBody * rb = r->world->importBody(bodies[i]);
+                r->ids[rb->getId()] = ids[i];
+                this->m_bodies[ids[i]].handle = r->world->getHandle(rb);
+            }
+            //the bodies are in memory, only now the file can go
+            this->m_store.remove(k);
+        }
+        return r;
+    }
+
+    void pageOut(long long k, region * r)
+    {
+        //the ghosts are not saved, the next step mirrors the bodies again if needed
+        removeGhosts(r);
+
+        vector<vRigidBody*> * bodies = r->world->getRigidBodies();
+        vector<long long> ids(bodies->size());
+        vector<vPhysics::bodyState> states(bodies->size());
+        for(int i = 0; i < bodies->size(); i++)
+        {
+            r->world->exportBody(bodies->at(i), states[i]);
+            ids[i] = r->ids[bodies->at(i)->getId()];
+            this->m_bodies[ids[i]].handle = vPhysics::bodyHandle();
+        }
+
+        //on failure the region stays in memory
+        if(!this->m_store.save(k, ids, states))
+        {
+            for(int i = 0; i < bodies->size(); i++) this->m_bodies[ids[i]].handle = r->world->getHandle(bodies->at(i));
+            return;
+        }
+
+        r->ids.clear();
+        delete r->world;
+        r->world = NULL;
+    }
+
+    //distance from an anchor to the closest point of the region
+    float distance(region * r, vec3 anchor)
+    {
+        vec3 d = anchor - regionOffset(r);
+        float h = this->m_regionSize * 0.5f;
+        vec3 out(std::max(std::abs(d.x) - h, .0f), std::max(std::abs(d.y) - h, .0f), std::max(std::abs(d.z) - h, .0f));
+        return glm::length(out);
+    }
+
+    void updatePaging()
+    {
+        //regions around the anchors: the ones on disk are loaded
+        int reach = (int)std::ceil(this->m_loadRadius / this->m_regionSize);
+        for(int a = 0; a < this->m_anchors.size(); a++)
+        {
+            int c[3];
+            cellOf(this->m_anchors[a], c);
+            for(int x = -reach; x <= reach; x++)
+            for(int y = -reach; y <= reach; y++)
+            for(int z = -reach; z <= reach; z++)
+            {
+                std::unordered_map<long long, region*>::iterator it = this->m_regions.find(key(c[0]+x, c[1]+y, c[2]+z));
+                if(it == this->m_regions.end() || it->second->world) continue;
+                if(distance(it->second, this->m_anchors[a]) < this->m_loadRadius) pageIn(it->first);
+            }
+        }
+
+        //far regions leave the memory, the empty ones are dropped (no anchors -> all in memory)
+        if(this->m_anchors.empty()) return;
+        vector<long long> drop;
+        for(std::unordered_map<long long, region*>::iterator it = this->m_regions.begin(); it != this->m_regions.end(); ++it)
+        {
+            region * r = it->second;
+            if(!r->world) continue;
+
+            bool near = false;
+            for(int a = 0; a < this->m_anchors.size() && !near; a++)
+                near = distance(r, this->m_anchors[a]) < this->m_loadRadius * 1.5f;
+            if(near) continue;
+
+            if(r->count == 0) drop.push_back(it->first);
+            else pageOut(it->first, r);
+        }
+
+        for(int i = 0; i < drop.size(); i++)
+        {
+            delete this->m_regions[drop[i]]->world;
+            delete this->m_regions[drop[i]];
+            this->m_regions.erase(drop[i]);
+        }
+    }
+
+    //the ghosts of a body that moved or has been removed
+    void dropGhosts(long long id)
+    {
+        for(std::unordered_map<long long, region*>::iterator it = this->m_regions.begin(); it != this->m_regions.end(); ++it)
+        {
+            region * n = it->second;
+            std::unordered_map<long long, vPhysics::bodyHandle>::iterator g = n->ghosts.find(id);
+            if(g == n->ghosts.end()) continue;
+            vRigidBody * ghost = n->world->getBody(g->second);
+            n->ghostIds.erase(ghost->getId());
+            n->world->removeBody(ghost);
+            n->ghosts.erase(g);
+        }
+    }
+
+    void removeGhosts(region * r)
+    {
+        for(std::unordered_map<long long, vPhysics::bodyHandle>::iterator it = r->ghosts.begin(); it != r->ghosts.end(); ++it)
+            r->world->removeBody(it->second);
+        r->ghosts.clear();
+        r->ghostIds.clear();
+    }
+
+    //the neighbour at (dx, dy, dz) comes before the region
+    static bool before(int dx, int dy, int dz)
+    {
+        return dx < 0 || (dx == 0 && (dy < 0 || (dy == 0 && dz < 0)));
+    }
+
+    //mirror the bodies near the borders into the loaded neighbours that come before their
+    //region, move the ghosts that are still needed and drop the others
+    void updateGhosts(const vector<region*> &loaded)
+    {
+        float h = this->m_regionSize * 0.5f;
+        std::unordered_map<region*, std::unordered_set<long long>> alive;
+        for(int i = 0; i < loaded.size(); i++)
+        {
+            region * r = loaded[i];
+            vec3 offset = regionOffset(r);
+            vector<vRigidBody*> * bodies = r->world->getRigidBodies();
+            for(int b = 0; b < bodies->size(); b++)
+            {
+                vRigidBody * rb = bodies->at(b);
+                if(!rb->isDynamic()) continue;
+                vec3 p = rb->getPosition();
+                if(std::abs(p.x) < h - this->ghostWidth && std::abs(p.y) < h - this->ghostWidth && std::abs(p.z) < h - this->ghostWidth) continue;
+
+                long long id = r->ids[rb->getId()];
+                vPhysics::bodyState s;
+                bool exported = false;
+                for(int dx = -1; dx <= 1; dx++)
+                for(int dy = -1; dy <= 1; dy++)
+                for(int dz = -1; dz <= 1; dz++)
+                {
+                    if(!before(dx, dy, dz)) continue;
+                    std::unordered_map<long long, region*>::iterator it = this->m_regions.find(key(r->x+dx, r->y+dy, r->z+dz));
+                    if(it == this->m_regions.end() || !it->second->world) continue;
+                    region * n = it->second;
+                    if(distance(n, p + offset) >= this->ghostWidth) continue;
+
+                    //from the frame of the body to the one of the neighbour
+                    vec3 shift = offset - regionOffset(n);
+                    alive[n].insert(id);
+                    std::unordered_map<long long, vPhysics::bodyHandle>::iterator g = n->ghosts.find(id);
+                    if(g != n->ghosts.end())
+                    {
+                        vRigidBody * ghost = n->world->getBody(g->second);
+                        for(int k = 0; k < rb->getParticles()->size(); k++)
+                        {
+                            vParticle &q = rb->getParticles()->at(k);
+                            ghost->getParticles()->at(k).setPosition(q.getPosition() + shift, q.getLastPosition() + shift);
+                        }
+                        continue;
+                    }
+                    if(!exported) r->world->exportBody(rb, s);
+                    exported = true;
+                    vRigidBody * ghost = n->world->importBody(s, shift);
+                    ghost->setGhost(true);
+                    n->ghosts[id] = n->world->getHandle(ghost);
+                    n->ghostIds[ghost->getId()] = id;
+                }
+            }
+        }
+
+        for(int i = 0; i < loaded.size(); i++)
+        {
+            region * n = loaded[i];
+            const std::unordered_set<long long> &keep = alive[n];
+            vector<long long> gone;
+            for(std::unordered_map<long long, vPhysics::bodyHandle>::iterator it = n->ghosts.begin(); it != n->ghosts.end(); ++it)
+                if(!keep.count(it->first)) gone.push_back(it->first);
+            for(int g = 0; g < gone.size(); g++)
+            {
+                vRigidBody * ghost = n->world->getBody(n->ghosts[gone[g]]);
+                n->ghostIds.erase(ghost->getId());
+                n->world->removeBody(ghost);
+                n->ghosts.erase(gone[g]);
+            }
+        }
+    }
+
+    //the responses on the ghosts of the region go to the bodies they mirror (offsets, the frame doesn't matter)
+    void pushGhosts(region * n)
+    {
+        vector<CollisionSolver::ghostResponse> * responses = n->world->getCollisionSolver()->getGhostResponses();
+        for(int i = 0; i < responses->size(); i++)
+        {
+            const CollisionSolver::ghostResponse &g = responses->at(i);
+            std::unordered_map<long long, location>::iterator it = this->m_bodies.find(n->ghostIds[g.body]);
+            if(it == this->m_bodies.end()) continue;
+            region * r = this->m_regions[it->second.region];
+            vRigidBody * rb = r->world ? r->world->getBody(it->second.handle) : NULL;
+            if(rb == NULL || g.particle >= rb->getParticles()->size()) continue;
+            vParticle &p = rb->getParticles()->at(g.particle);
+            p.setPosition(p.getPosition() + g.dPos, p.getLastPosition() + g.dOld);
+        }
+    }
+
+    //bodies whose center left the region move to the region that contains it now
+    void migrate(region * r)
+    {
+        float h = this->m_regionSize * 0.5f;
+        vector<vRigidBody*> leaving;
+        vector<vRigidBody*> * bodies = r->world->getRigidBodies();
+        for(int i = 0; i < bodies->size(); i++)
+        {
+            vRigidBody * rb = bodies->at(i);
+            if(!rb->isDynamic()) continue;
+            vec3 p = rb->getPosition();
+            if(std::abs(p.x) > h || std::abs(p.y) > h || std::abs(p.z) > h) leaving.push_back(rb);
+        }
+
+        vec3 offset = regionOffset(r);
+        for(int i = 0; i < leaving.size(); i++)
+        {
+            vRigidBody * rb = leaving[i];
+            long long id = r->ids[rb->getId()];
+            vPhysics::bodyState s;
+            r->world->exportBody(rb, s);
+
+            vec3 local;
+            region * to = regionAt(rb->getPosition() + offset, local);
+            if(to == NULL) continue; //stays here
+
+            r->ids.erase(rb->getId());
+            r->world->removeBody(rb);
+            r->count--;
+            dropGhosts(id);
+
+            //from the old frame to the new one
+            vRigidBody * moved = to->world->importBody(s, offset - regionOffset(to));
+            to->ids[moved->getId()] = id;
+            to->count++;
+            this->m_bodies[id].region = key(to->x, to->y, to->z);
+            this->m_bodies[id].handle = to->world->getHandle(moved);
+        }
+    }
+};
@@ -0,0 +1,256 @@
+/*
+VERLET PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+//Physics class
+#include <physics/verlet/verlet_rb_v1.h>
+
+#include <vector>
+#include <cstring>
+#include <iostream>
+
+//Ring of the last N states of the rigidbodies used to roll back and re-simulate frames
+//(vPhysics refuses to roll back worlds with particle systems or soft bodies).
+//Each saved frame only stores the particles that changed since the previous
+//saved frame (their previous value, as an undo record), so restoring frame N
+//costs O(changed particles) and never touches the connections.
+//The small per body state (level of detail, dt of the last integration) is copied whole
+//every frame, so bodies integrated at a lower rate re-simulate the same way.
+class vRollback
+{
+    struct record
+    {
+        int index;      //index in the flat particle list
+        vec3 now, old;  //particle state before the frame was saved
+    };
+
+    struct frame
+    {
+        int number = -1;
+        vector<record> undo;
+    };
+
+    struct bodyState
+    {
+        vRigidBody::lodState lod;
+        float dt;
+    };
+
+    struct hash
+    {
+        int number = -1;
+        unsigned long long value = 0;
+    };
+
+    int m_capacity;
+    vector<frame> m_ring;
+    vector<hash> m_hashes;
+    vector<vector<bodyState>> m_bodyStates; //frame n in n % (capacity+1): oldest to newest
+
+    //flat view of all the particles of the world + shadow copy of the last saved state
+    vector<vRigidBody*> m_bodies;
+    vector<vParticle*> m_particles;
+    vector<vec3> m_now, m_old;
+    bool m_bound = false;
+
+    int m_newest = -1; //last saved frame
+    int m_oldest = -1; //oldest frame that can be restored
+
+    bool m_check;
+    int m_mismatches = 0;
+    int m_lastMismatch = -1;
+
+public:
+    vRollback(int frames, bool determinismCheck = false)
+    {
+        this->m_capacity = frames < 1 ? 1 : frames;
+        this->m_ring.resize(this->m_capacity);
+        this->m_hashes.resize(this->m_capacity);
+        this->m_bodyStates.resize(this->m_capacity+1);
+        this->m_check = determinismCheck;
+    }
+
+    //must be called every time a body is added or removed
+    //the history is dropped and the next saved frame becomes the new baseline
+    void invalidate()
+    {
+        this->m_bound = false;
+    }
+
+    //store the state of the world as frame number 'n'
+    void save(int n, vector<vRigidBody*> &bodies)
+    {
+        if(!this->m_bound || n != this->m_newest+1)
+        {
+            bind(bodies);
+            this->m_newest = n;
+            this->m_oldest = n;
+            saveBodies(n);
+            if(this->m_check) checkHash(n);
+            return;
+        }
+
+        frame &f = this->m_ring.at(n % this->m_capacity);
+        f.number = n;
+        f.undo.clear();
+
+        for(int i = 0; i < this->m_particles.size(); i++)
+        {
+            vec3 now = this->m_particles[i]->getPosition();
+            vec3 old = this->m_particles[i]->getLastPosition();
+            if(now != this->m_now[i] || old != this->m_old[i])
+            {
+                f.undo.push_back(record{ i, this->m_now[i], this->m_old[i] });
+                this->m_now[i] = now;
+                this->m_old[i] = old;
+            }
+        }
+
+        this->m_newest = n;
+        //the frame we just overwrote can't be undone anymore
+        if(this->m_newest - this->m_oldest > this->m_capacity) this->m_oldest = this->m_newest - this->m_capacity;
+
+        saveBodies(n);
+        if(this->m_check) checkHash(n);
+    }
+
+    //bring the world back to the state saved as frame number 'n'
+    //returns false if 'n' is not in the ring anymore
+    bool restore(int n)
+    {
+        if(!this->m_bound || n < this->m_oldest || n > this->m_newest) return false;
+
+        for(int k = this->m_newest; k > n; k--)
+        {
+            frame &f = this->m_ring.at(k % this->m_capacity);
+            for(int i = (int)f.undo.size()-1; i >= 0; i--)
+            {
+                const record &r = f.undo[i];
+                this->m_particles[r.index]->setPosition(r.now, r.old);
+                this->m_now[r.index] = r.now;
+                this->m_old[r.index] = r.old;
+            }
+            f.number = -1;
+            f.undo.clear();
+        }
+
+        this->m_newest = n;
+
+        const vector<bodyState> &states = this->m_bodyStates.at(n % (this->m_capacity+1));
+        for(int i = 0; i < this->m_bodies.size(); i++)
+        {
+            vRigidBody * rb = this->m_bodies.at(i);
+            rb->getLod() = states[i].lod;
+            for(int j = 0; j < rb->getParticles()->size(); j++) rb->getParticles()->at(j).setDt(states[i].dt);
+        }
+        return true;
+    }
+
+    //the bodies moved their particles to a new storage (same bodies, same particles):
+    //refresh the particle pointers keeping the history
+    void relocate()
+    {
+        if(this->m_bound) collectParticles();
+    }
+
+    int getCapacity() { return this->m_capacity; }
+
+    int getNewest() { return this->m_newest; }
+
+    int getOldest() { return this->m_oldest; }
+
+    //determinism check: number of re-simulated frames whose hash differs from the first run
+    int getMismatches() { return this->m_mismatches; }
+
+    int getLastMismatch() { return this->m_lastMismatch; }
+
+    //FNV-1a over the raw bits of the particles state
+    unsigned long long hashState()
+    {
+        unsigned long long h = 14695981039346656037ULL;
+        for(int i = 0; i < this->m_now.size(); i++)
+        {
+            h = hashBytes(h, &this->m_now[i], sizeof(vec3));
+            h = hashBytes(h, &this->m_old[i], sizeof(vec3));
+        }
+        return h;
+    }
+
+private:
+    void saveBodies(int n)
+    {
+        vector<bodyState> &states = this->m_bodyStates.at(n % (this->m_capacity+1));
+        states.resize(this->m_bodies.size());
+        for(int i = 0; i < this->m_bodies.size(); i++)
+        {
+            vRigidBody * rb = this->m_bodies.at(i);
+            states[i].lod = rb->getLod();
+            states[i].dt = rb->getParticles()->empty() ? .0f : rb->getParticles()->at(0).getDt();
+        }
+    }
+
+    void collectParticles()
+    {
+        this->m_particles.clear();
+        for(int i = 0; i < this->m_bodies.size(); i++)
+            for(int j = 0; j < this->m_bodies.at(i)->getParticles()->size(); j++)
+                this->m_particles.push_back(&this->m_bodies.at(i)->getParticles()->at(j));
+    }
+
+    void bind(vector<vRigidBody*> &bodies)
+    {
+        this->m_bodies = bodies;
+        collectParticles();
+
+        this->m_now.resize(this->m_particles.size());
+        this->m_old.resize(this->m_particles.size());
+        for(int i = 0; i < this->m_particles.size(); i++)
+        {
+            this->m_now[i] = this->m_particles[i]->getPosition();
+            this->m_old[i] = this->m_particles[i]->getLastPosition();
+        }
+
+        for(int i = 0; i < this->m_capacity; i++)
+        {
+            this->m_ring[i].number = -1;
+            this->m_ring[i].undo.clear();
+            this->m_hashes[i].number = -1;
+        }
+
+        this->m_bound = true;
+    }
+
+    void checkHash(int n)
+    {
+        hash &h = this->m_hashes.at(n % this->m_capacity);
+        unsigned long long value = hashState();
+
+        //the frame was already simulated once -> re-simulation must be bit identical
+        if(h.number == n && h.value != value)
+        {
+            this->m_mismatches++;
+            this->m_lastMismatch = n;
+            std::cout << "verlet rollback -> non deterministic step at frame " << n << std::endl;
+        }
+
+        h.number = n;
+        h.value = value;
+    }
+
+    static unsigned long long hashBytes(unsigned long long h, const void *data, size_t size)
+    {
+        const unsigned char *b = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < size; i++)
+        {
+            h ^= b[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+};
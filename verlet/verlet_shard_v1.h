@@ -0,0 +1,297 @@
+/*
+VERLET PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+//Physics class
+#include <physics/verlet/verlet_physics_v1.h>
+#include <physics/transport_v1.h>
+
+#include <vector>
+#include <cstring>
+#include <cfloat>
+#include <unordered_map>
+#include <unordered_set>
+
+//One process of a world split in 'count' slabs along x, shard 'index' simulates [m_lo, m_hi).
+//After each step the shard sends to each neighbour the bodies that crossed into its slab (the
+//ownership moves with them), and to the left neighbour the bodies closer than 'ghostWidth' to
+//the common border. The left neighbour mirrors them as ghosts (vRigidBody::setGhost): copies
+//that collide with their real mass but are never integrated, so every pair across a border is
+//resolved once, by the shard on the left. It keeps the responses on the ghosts and sends them
+//back to the owner at the next exchange. Static bodies are replicated in every shard.
+//All the processes run the same setup: bodies are added everywhere, each shard keeps only the
+//ones in its slab, and the order of the add calls gives every body the same global id in all shards.
+class vShard
+{
+    struct entry
+    {
+        long long id;
+        vPhysics::bodyState state;
+    };
+
+    //response on a ghost, for the shard that owns the body
+    struct push
+    {
+        long long id;
+        int particle;
+        vec3 dPos, dOld;
+    };
+
+    int m_index, m_count;
+    float m_lo, m_hi;
+    float m_ghostWidth;
+
+    vPhysics * m_world;
+    vTransport * m_transport;
+
+    long long m_nextId = 0;
+    std::unordered_map<long long, vPhysics::bodyHandle> m_owned;
+    std::unordered_map<long long, vPhysics::bodyHandle> m_ghosts[2]; //by side, only the right neighbour sends them
+    std::unordered_map<int, long long> m_ids; //local body id -> global id
+
+public:
+    vShard(int index, int count, float worldSize, float ghostWidth, vTransport * transport)
+    {
+        this->m_index = index;
+        this->m_count = count;
+        this->m_ghostWidth = ghostWidth;
+        this->m_transport = transport;
+
+        //the first and the last slab extend to the world bounds
+        float side = 2.0f*worldSize / count;
+        this->m_lo = index == 0 ? -FLT_MAX : -worldSize + side*index;
+        this->m_hi = index == count-1 ? FLT_MAX : -worldSize + side*(index+1);
+
+        this->m_world = new vPhysics();
+        this->m_world->setWorld(worldSize);
+    }
+
+    ~vShard()
+    {
+        delete this->m_world;
+    }
+
+    vShard(const vShard&) = delete;
+
+    vShard& operator=(const vShard&) = delete;
+
+    //returns the global id, the body exists here only if this shard owns it
+    long long addBox(vPhysics::boxPrefab b)
+    {
+        long long id = this->m_nextId++;
+        if(b.staticBody || owns(b.pos)) own(id, this->m_world->addBox(b));
+        return id;
+    }
+
+    long long addSphere(vPhysics::spherePrefab s)
+    {
+        long long id = this->m_nextId++;
+        if(s.staticBody || owns(s.pos)) own(id, this->m_world->addSphere(s));
+        return id;
+    }
+
+    void step(float dt)
+    {
+        this->m_world->step(dt);
+        exchange();
+    }
+
+    //NULL if the body is not owned by this shard
+    vRigidBody* getBody(long long id)
+    {
+        std::unordered_map<long long, vPhysics::bodyHandle>::iterator it = this->m_owned.find(id);
+        return it == this->m_owned.end() ? NULL : this->m_world->getBody(it->second);
+    }
+
+    void getOwned(vector<long long> &ids)
+    {
+        for(std::unordered_map<long long, vPhysics::bodyHandle>::iterator it = this->m_owned.begin(); it != this->m_owned.end(); ++it)
+            ids.push_back(it->first);
+    }
+
+    int getGhostCount() { return this->m_ghosts[0].size() + this->m_ghosts[1].size(); }
+
+    //owned, ghosts and static replicas
+    vPhysics* getWorld() { return this->m_world; }
+
+private:
+    bool owns(vec3 pos)
+    {
+        return pos.x >= this->m_lo && pos.x < this->m_hi;
+    }
+
+    void own(long long id, vRigidBody * rb)
+    {
+        this->m_ids[rb->getId()] = id;
+        if(!rb->isStatic()) this->m_owned[id] = this->m_world->getHandle(rb);
+    }
+
+    void remove(vRigidBody * rb)
+    {
+        this->m_ids.erase(rb->getId());
+        this->m_world->removeBody(rb);
+    }
+
+    template <class E> static void write(vector<char> &msg, const vector<E> &list)
+    {
+        int n = list.size();
+        size_t at = msg.size();
+        msg.resize(at + sizeof(int) + n*sizeof(E));
+        std::memcpy(&msg[at], &n, sizeof(int));
+        if(n > 0) std::memcpy(&msg[at + sizeof(int)], list.data(), n*sizeof(E));
+    }
+
+    template <class E> static size_t read(const vector<char> &msg, size_t at, vector<E> &list)
+    {
+        int n = 0;
+        if(at + sizeof(int) > msg.size()) return msg.size();
+        std::memcpy(&n, &msg[at], sizeof(int));
+        at += sizeof(int);
+        if(n < 0 || at + n*sizeof(E) > msg.size()) return msg.size();
+        list.resize(n);
+        if(n > 0) std::memcpy(list.data(), &msg[at], n*sizeof(E));
+        return at + n*sizeof(E);
+    }
+
+    //the lower index of a pair sends first, so a chain of shards never waits in a circle.
+    //'sent' tells if the neighbour got 'out', the result if 'in' arrived too
+    bool trade(int peer, const vector<char> &out, vector<char> &in, bool &sent)
+    {
+        bool ok;
+        if(peer > this->m_index)
+        {
+            sent = this->m_transport->send(peer, out);
+            ok = sent && this->m_transport->receive(peer, in);
+        }
+        else
+        {
+            ok = this->m_transport->receive(peer, in);
+            sent = ok && this->m_transport->send(peer, out);
+            ok = sent;
+        }
+        if(!ok) std::cout << "verlet shard " << this->m_index << " -> exchange with " << peer << " failed" << std::endl;
+        return ok;
+    }
+
+    //side 0 = left neighbour, 1 = right neighbour
+    void exchange()
+    {
+        int peer[2] = { this->m_index-1, this->m_index+1 };
+
+        //1 - the responses on the ghosts (they all come from the right) go back to their owners
+        vector<push> pushes;
+        vector<CollisionSolver::ghostResponse> * responses = this->m_world->getCollisionSolver()->getGhostResponses();
+        for(int i = 0; i < responses->size(); i++)
+        {
+            const CollisionSolver::ghostResponse &r = responses->at(i);
+            pushes.push_back(push{ this->m_ids[r.body], r.particle, r.dPos, r.dOld });
+        }
+        for(int s = 0; s < 2; s++)
+        {
+            if(peer[s] < 0 || peer[s] >= this->m_count) continue;
+            vector<char> out, in;
+            write(out, s == 1 ? pushes : vector<push>());
+            bool sent;
+            if(!trade(peer[s], out, in, sent)) continue;
+            vector<push> arrived;
+            read(in, 0, arrived);
+            for(int i = 0; i < arrived.size(); i++)
+            {
+                vRigidBody * rb = getBody(arrived[i].id);
+                if(rb == NULL || arrived[i].particle < 0 || arrived[i].particle >= rb->getParticles()->size()) continue;
+                vParticle &p = rb->getParticles()->at(arrived[i].particle);
+                p.setPosition(p.getPosition() + arrived[i].dPos, p.getLastPosition() + arrived[i].dOld);
+            }
+        }
+
+        //2 - migrants and ghosts
+        vector<entry> migrants[2], ghosts[2];
+        vector<vRigidBody*> leaving[2];
+
+        for(std::unordered_map<long long, vPhysics::bodyHandle>::iterator it = this->m_owned.begin(); it != this->m_owned.end(); ++it)
+        {
+            vRigidBody * rb = this->m_world->getBody(it->second);
+            float x = rb->getPosition().x;
+            entry e;
+            e.id = it->first;
+            this->m_world->exportBody(rb, e.state);
+
+            if(x < this->m_lo) { migrants[0].push_back(e); leaving[0].push_back(rb); }
+            else if(x >= this->m_hi) { migrants[1].push_back(e); leaving[1].push_back(rb); }
+            else
+            {
+                //the pairs across the left border are resolved by the left neighbour
+                if(this->m_index > 0 && x < this->m_lo + this->m_ghostWidth) ghosts[0].push_back(e);
+            }
+        }
+
+        vector<char> in[2];
+        for(int s = 0; s < 2; s++)
+        {
+            if(peer[s] < 0 || peer[s] >= this->m_count) continue;
+            vector<char> out;
+            write(out, migrants[s]);
+            write(out, ghosts[s]);
+
+            bool sent;
+            trade(peer[s], out, in[s], sent);
+
+            //the migrants leave only once the neighbour has them, otherwise they stay here and retry next step
+            if(!sent) continue;
+            for(int i = 0; i < leaving[s].size(); i++)
+            {
+                this->m_owned.erase(this->m_ids[leaving[s][i]->getId()]);
+                remove(leaving[s][i]);
+            }
+        }
+
+        for(int s = 0; s < 2; s++)
+        {
+            vector<entry> arrived, mirrored;
+            size_t at = read(in[s], 0, arrived);
+            read(in[s], at, mirrored);
+            apply(s, arrived, mirrored);
+        }
+    }
+
+    void apply(int side, const vector<entry> &arrived, const vector<entry> &mirrored)
+    {
+        std::unordered_map<long long, vPhysics::bodyHandle> &ghosts = this->m_ghosts[side];
+
+        //ghosts that are gone (left the border zone or moved here)
+        std::unordered_set<long long> alive;
+        for(int i = 0; i < mirrored.size(); i++) alive.insert(mirrored[i].id);
+        vector<long long> gone;
+        for(std::unordered_map<long long, vPhysics::bodyHandle>::iterator it = ghosts.begin(); it != ghosts.end(); ++it)
+            if(!alive.count(it->first)) gone.push_back(it->first);
+        for(int i = 0; i < gone.size(); i++)
+        {
+            remove(this->m_world->getBody(ghosts[gone[i]]));
+            ghosts.erase(gone[i]);
+        }
+
+        for(int i = 0; i < arrived.size(); i++) own(arrived[i].id, this->m_world->importBody(arrived[i].state));
+
+        for(int i = 0; i < mirrored.size(); i++)
+        {
+            const entry &e = mirrored[i];
+            std::unordered_map<long long, vPhysics::bodyHandle>::iterator it = ghosts.find(e.id);
+            if(it != ghosts.end())
+            {
+                vRigidBody * rb = this->m_world->getBody(it->second);
+                for(int k = 0; k < e.state.particles; k++) rb->getParticles()->at(k).setPosition(e.state.now[k], e.state.old[k]);
+                continue;
+            }
+            vRigidBody * rb = this->m_world->importBody(e.state);
+            rb->setGhost(true);
+            this->m_ids[rb->getId()] = e.id;
+            ghosts[e.id] = this->m_world->getHandle(rb);
+        }
+    }
+};
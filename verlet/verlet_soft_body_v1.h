@@ -0,0 +1,307 @@
+/*
+VERLET PHYSISC
+
+author: Paolo Bonomi
+
+Real-Time Graphics Programming's Project - 2020/2021
+*/
+
+#pragma once
+
+//Physics class
+#include <physics/verlet/verlet_connection_v1.h>
+#include <physics/verlet/verlet_particle_system_v1.h>
+#include <physics/thread_pool_v1.h>
+
+#include <vector>
+#include <cfloat>
+#include <algorithm>
+
+//Chains and grids of particles held together by distance constraints (ropes, cables, flags).
+//Particles and constraints live in flat arrays instead of a vector of vConnection per object:
+//the constraints are graph coloured (no two constraints of a colour share a particle) and
+//stored in solve order, colour after colour, so every colour is a contiguous batch that is
+//projected in parallel with the same kernel of vConnection.
+//The particles collide with the rigidbodies as the ones of vParticleSystem (one way).
+class vSoftBody
+{
+protected:
+    vTaggedVector<vec3, MEMORY_PARTICLES> m_pos, m_old;
+    vTaggedVector<float, MEMORY_PARTICLES> m_radius, m_invMass;
+    float m_mass;
+
+    //constraints in solve order, colour c is [m_colorStart[c], m_colorStart[c+1])
+    vTaggedVector<int, MEMORY_CONNECTIONS> m_a, m_b;
+    vTaggedVector<float, MEMORY_CONNECTIONS> m_rest;
+    vTaggedVector<int, MEMORY_CONNECTIONS> m_colorStart;
+    int m_serialColor = -1; //constraints that didn't fit in a colour, solved by one thread
+
+    vec3 m_min, m_max;
+    float m_worldSize;
+    vThreadPool * m_pool;
+
+    static const int MAX_COLORS = 64;
+
+public:
+    float drag;
+    float bounciness = .2f;
+    bool gravity;
+    bool bodyCollisions = true;
+    int iterations = 8; //constraint passes per step
+
+    vSoftBody(float mass, float drag, bool gravity, float worldSize, vThreadPool * pool = &vThreadPool::global())
+    {
+        this->m_mass = mass;
+        this->drag = drag;
+        this->gravity = gravity;
+        this->m_worldSize = worldSize;
+        this->m_pool = pool;
+    }
+
+    virtual ~vSoftBody() {}
+
+    void step(float dt, vector<vRigidBody*> * bodies = NULL)
+    {
+        int n = this->m_pos.size();
+        if(n == 0) return;
+
+        vParticleSystem::integrate(n, this->m_pos.data(), this->m_old.data(), this->m_radius.data(), this->m_invMass.data(),
+                                   dt, this->gravity, this->drag, this->bounciness, this->m_worldSize, this->m_pool);
+
+        for(int i = 0; i < this->iterations; i++) solveConstraints();
+
+        updateBounds();
+        if(this->bodyCollisions && bodies)
+            for(int i = 0; i < bodies->size(); i++) if(!bodies->at(i)->isTrigger()) collide(bodies->at(i));
+    }
+
+    //pinned particles have infinite mass: they are never integrated nor pushed
+    void pin(int i, bool pinned = true)
+    {
+        this->m_invMass[i] = pinned ? .0f : 1.0f/this->m_mass;
+    }
+
+    bool isPinned(int i) { return this->m_invMass[i] == 0; }
+
+    //to drag the pinned particles around
+    void setPosition(int i, vec3 pos)
+    {
+        this->m_pos[i] = pos;
+    }
+
+    int size() { return this->m_pos.size(); }
+
+    const vec3* getPositions() { return this->m_pos.data(); }
+
+    vec3 getPosition(int i) { return this->m_pos[i]; }
+
+    int getConstraintCount() { return this->m_a.size(); }
+
+    //the i-th constraint in solve order
+    void getConstraint(int i, int &a, int &b)
+    {
+        a = this->m_a[i];
+        b = this->m_b[i];
+    }
+
+    int getColorCount() { return this->m_colorStart.empty() ? 0 : this->m_colorStart.size()-1; }
+
+    void getBounds(vec3 &min, vec3 &max)
+    {
+        min = this->m_min;
+        max = this->m_max;
+    }
+
+protected:
+    int addParticle(vec3 pos, float radius)
+    {
+        this->m_pos.push_back(pos);
+        this->m_old.push_back(pos);
+        this->m_radius.push_back(radius);
+        this->m_invMass.push_back(this->m_mass > 0 ? 1.0f/this->m_mass : .0f);
+        return this->m_pos.size()-1;
+    }
+
+    //rest length is the current distance
+    void addConstraint(int a, int b)
+    {
+        this->m_a.push_back(a);
+        this->m_b.push_back(b);
+        this->m_rest.push_back(glm::distance(this->m_pos[a], this->m_pos[b]));
+    }
+
+    //greedy colouring in creation order, then the constraints are sorted by colour and
+    //inside a colour by first particle, so a batch walks the particles forward
+    void colorConstraints()
+    {
+        int m = this->m_a.size();
+        vector<unsigned long long> used(this->m_pos.size(), 0);
+        vector<int> color(m);
+        int colors = 0;
+
+        for(int i = 0; i < m; i++)
+        {
+            unsigned long long u = used[this->m_a[i]] | used[this->m_b[i]];
+            int c = 0;
+            while(c < MAX_COLORS && ((u >> c) & 1ULL)) c++;
+            if(c < MAX_COLORS)
+            {
+                used[this->m_a[i]] |= 1ULL << c;
+                used[this->m_b[i]] |= 1ULL << c;
+            }
+            color[i] = c;
+            if(c+1 > colors) colors = c+1;
+        }
+
+        vector<int> order(m);
+        for(int i = 0; i < m; i++) order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](int i, int j)
+        {
+            if(color[i] != color[j]) return color[i] < color[j];
+            return std::min(this->m_a[i], this->m_b[i]) < std::min(this->m_a[j], this->m_b[j]);
+        });
+
+        vTaggedVector<int, MEMORY_CONNECTIONS> a(m), b(m);
+        vTaggedVector<float, MEMORY_CONNECTIONS> rest(m);
+        for(int i = 0; i < m; i++)
+        {
+            a[i] = this->m_a[order[i]];
+            b[i] = this->m_b[order[i]];
+            rest[i] = this->m_rest[order[i]];
+        }
+        this->m_a.swap(a);
+        this->m_b.swap(b);
+        this->m_rest.swap(rest);
+
+        this->m_colorStart.assign(colors+1, 0);
+        for(int i = 0; i < m; i++) this->m_colorStart[color[i]+1]++;
+        for(int c = 0; c < colors; c++) this->m_colorStart[c+1] += this->m_colorStart[c];
+        this->m_serialColor = colors > MAX_COLORS ? MAX_COLORS : -1;
+
+        updateBounds();
+    }
+
+private:
+    void solveRange(int begin, int end)
+    {
+        for(int j = begin; j < end; j++)
+        {
+            int a = this->m_a[j], b = this->m_b[j];
+            float wa = this->m_invMass[a], wb = this->m_invMass[b];
+            float w = wa + wb;
+            if(w == 0) continue;
+            vConnection::project(this->m_pos[a], this->m_pos[b], wa/w, wb/w, this->m_rest[j]);
+        }
+    }
+
+    void solveConstraints()
+    {
+        for(int c = 0; c+1 < this->m_colorStart.size(); c++)
+        {
+            int first = this->m_colorStart[c];
+            int count = this->m_colorStart[c+1] - first;
+
+            if(c == this->m_serialColor) solveRange(first, first+count);
+            else this->m_pool->parallelFor(count, [&](int begin, int end) { solveRange(first+begin, first+end); }, 256);
+        }
+    }
+
+    void updateBounds()
+    {
+        vec3 lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for(int i = 0; i < this->m_pos.size(); i++)
+        {
+            vec3 r(this->m_radius[i], this->m_radius[i], this->m_radius[i]);
+            lo = glm::min(lo, this->m_pos[i] - r);
+            hi = glm::max(hi, this->m_pos[i] + r);
+        }
+        this->m_min = lo;
+        this->m_max = hi;
+    }
+
+    void collide(vRigidBody * rb)
+    {
+        vec3 min, max;
+        rb->getBounds(min, max);
+        if(min.x > this->m_max.x || max.x < this->m_min.x ||
+           min.y > this->m_max.y || max.y < this->m_min.y ||
+           min.z > this->m_max.z || max.z < this->m_min.z) return;
+
+        vector<int> candidates;
+        for(int i = 0; i < this->m_pos.size(); i++)
+        {
+            vec3 p = this->m_pos[i];
+            float r = this->m_radius[i];
+            if(p.x + r >= min.x && p.x - r <= max.x && p.y + r >= min.y && p.y - r <= max.y && p.z + r >= min.z && p.z - r <= max.z)
+                candidates.push_back(i);
+        }
+
+        vParticleSystem::collideBody(rb, candidates, this->m_pos.data(), this->m_old.data(), this->m_radius.data(), this->m_invMass.data(), this->bounciness, this->m_pool);
+    }
+};
+
+class vRope : public vSoftBody
+{
+public:
+    //'segments'+1 particles from 'from' to 'to', bend constraints link every other particle
+    vRope(vec3 from, vec3 to, int segments, float radius, float mass, float drag, bool useGravity, bool bend, float worldSize) :
+    vSoftBody(mass, drag, useGravity, worldSize)
+    {
+        if(segments < 1) segments = 1;
+        this->m_pos.reserve(segments+1);
+        for(int i = 0; i <= segments; i++) addParticle(from + (to - from) * (i / (float)segments), radius);
+
+        for(int i = 0; i < segments; i++) addConstraint(i, i+1);
+        if(bend) for(int i = 0; i+2 <= segments; i++) addConstraint(i, i+2);
+
+        colorConstraints();
+    }
+};
+
+class vCloth : public vSoftBody
+{
+    int m_width, m_height;
+
+public:
+    //width x height particles from 'corner' along 'right' and 'down' (full edges of the cloth),
+    //particle (x, y) is x + y*width
+    vCloth(vec3 corner, vec3 right, vec3 down, int width, int height, float radius, float mass, float drag, bool useGravity, bool shear, bool bend, float worldSize) :
+    vSoftBody(mass, drag, useGravity, worldSize)
+    {
+        if(width < 2) width = 2;
+        if(height < 2) height = 2;
+        this->m_width = width;
+        this->m_height = height;
+
+        vec3 dx = right / (float)(width-1);
+        vec3 dy = down / (float)(height-1);
+        this->m_pos.reserve(width*height);
+        for(int y = 0; y < height; y++)
+            for(int x = 0; x < width; x++)
+                addParticle(corner + dx*(float)x + dy*(float)y, radius);
+
+        //row by row, every constraint only looks forward
+        for(int y = 0; y < height; y++)
+            for(int x = 0; x < width; x++)
+            {
+                int i = x + y*width;
+                if(x+1 < width) addConstraint(i, i+1);
+                if(y+1 < height) addConstraint(i, i+width);
+                if(shear && x+1 < width && y+1 < height)
+                {
+                    addConstraint(i, i+width+1);
+                    addConstraint(i+1, i+width);
+                }
+                if(bend && x+2 < width) addConstraint(i, i+2);
+                if(bend && y+2 < height) addConstraint(i, i+2*width);
+            }
+
+        colorConstraints();
+    }
+
+    int getWidth() { return this->m_width; }
+
+    int getHeight() { return this->m_height; }
+
+    int getIndex(int x, int y) { return x + y*this->m_width; }
+};